@@ -9,9 +9,12 @@
 #include "elf.h"
 #include "FileClass.h"
 #include "ByteBuffer.h"
+#include "MappedFile.h"
 #include "smdh.h"
 #include "ctr_app_icon.h"
 #include "romfs.h"
+#include "thread_pool.h"
+#include "reloc_map.h"
 
 using std::vector;
 using std::map;
@@ -49,6 +52,13 @@ struct RelocHdr
 	u32 cRelative;
 };
 
+// relocation sections that patch the same section
+struct RelocTarget
+{
+	int sect;
+	vector<int> relSects;
+};
+
 struct SymConv
 {
 	const char* name;
@@ -74,8 +84,10 @@ class ElfConvert
 
 	u32 baseAddr, topAddr;
 
-	vector<bool> absRelocMap, relRelocMap;
+	RelocMap absRelocMap, relRelocMap;
 	vector<RelocEntry> relocData;
+	vector<RelocTarget> relocTargets;
+	ThreadPool pool;
 
 	RelocHdr relocHdr[3];
 
@@ -90,33 +102,31 @@ class ElfConvert
 	int ScanSections();
 
 	int ScanRelocSection(u32 vsect, byte_t* sectData, Elf32_Sym* symTab, Elf32_Rel* relTab, int relCount);
+	int ScanRelocTarget(size_t index);
+	static int ScanRelocTargetTask(void* arg, size_t index);
 	int ScanRelocations();
 
-	void BuildRelocs(vector<bool>& map, int pos, int posEnd, u32& count);
+	void BuildRelocs(const RelocMap& map, int pos, int posEnd, u32& count);
 
-	void SetReloc(u32 address, vector<bool>& map)
+	void SetReloc(u32 address, RelocMap& map)
 	{
 		address = (address-baseAddr)/4;
 		if (address >= map.size()) return;
-		map[address] = true;
-	}
-
-	bool HasReloc(u32 address, vector<bool>& map)
-	{
-		address = (address-baseAddr)/4;
-		return map[address];
+		map.Set(address);
 	}
 
 	bool HasReloc(u32 address)
 	{
-		return HasReloc(address, absRelocMap) || HasReloc(address, relRelocMap);
+		address = (address-baseAddr)/4;
+		if (address >= absRelocMap.size()) return false;
+		return absRelocMap.Test(address) || relRelocMap.Test(address);
 	}
 
 public:
 	ElfConvert(const char* f, byte_t* i, int x)
 		: fout(f, "wb"), img(i), platFlags(x), elfSyms(NULL)
 		, absRelocMap(), relRelocMap()
-		, relocData()
+		, relocData(), relocTargets()
 		, codeSeg(NULL), rodataSeg(NULL), dataSeg(NULL)
 		, codeSegSize(0), rodataSegSize(0), dataSegSize(0), bssSize(0)
 		, hasExtHeader(false), extHeaderPos(0)
@@ -125,7 +135,7 @@ public:
 	int Convert();
 
 	void EnableExtHeader() { hasExtHeader = true; }
-	int WriteExtHeader(const ByteBuffer& smdh, const char* romfsDir);
+	int WriteExtHeader(const ByteBuffer& smdh, const char* romfsDir, bool romfsDedup);
 };
 
 int ElfConvert::ScanRelocSection(u32 vsect, byte_t* sectData, Elf32_Sym* symTab, Elf32_Rel* relTab, int relCount)
@@ -223,6 +233,32 @@ int ElfConvert::ScanRelocSection(u32 vsect, byte_t* sectData, Elf32_Sym* symTab,
 	return 0;
 }
 
+int ElfConvert::ScanRelocTarget(size_t index)
+{
+	const RelocTarget& target = relocTargets[index];
+	Elf32_Shdr* targetSect = elfSects + target.sect;
+
+	u32 vsect = le_word(targetSect->sh_addr);
+	byte_t* sectData = img + le_word(targetSect->sh_offset);
+
+	for (size_t i = 0; i < target.relSects.size(); i ++)
+	{
+		Elf32_Shdr* sect = elfSects + target.relSects[i];
+		Elf32_Sym* symTab = (Elf32_Sym*)(img + le_word(elfSects[le_word(sect->sh_link)].sh_offset));
+		Elf32_Rel* relTab = (Elf32_Rel*)(img + le_word(sect->sh_offset));
+		int relCount = (int)(le_word(sect->sh_size) / le_word(sect->sh_entsize));
+
+		safe_call(ScanRelocSection(vsect, sectData, symTab, relTab, relCount));
+	}
+
+	return 0;
+}
+
+int ElfConvert::ScanRelocTargetTask(void* arg, size_t index)
+{
+	return ((ElfConvert*)arg)->ScanRelocTarget(index);
+}
+
 int ElfConvert::ScanRelocations()
 {
 	for (int i = 0; i < elfSectCount; i ++)
@@ -234,20 +270,26 @@ int ElfConvert::ScanRelocations()
 		else if (sectType != SHT_REL)
 			continue;
 
-		Elf32_Shdr* targetSect = elfSects + le_word(sect->sh_info);
+		int targetIndex = (int)le_word(sect->sh_info);
+		Elf32_Shdr* targetSect = elfSects + targetIndex;
 		if (!(le_word(targetSect->sh_flags) & SHF_ALLOC))
 			continue; // Ignore non-loadable sections
 
-		u32 vsect = le_word(targetSect->sh_addr);
-		byte_t* sectData = img + le_word(targetSect->sh_offset);
-
-		Elf32_Sym* symTab = (Elf32_Sym*)(img + le_word(elfSects[le_word(sect->sh_link)].sh_offset));
-		Elf32_Rel* relTab = (Elf32_Rel*)(img + le_word(sect->sh_offset));
-		int relCount = (int)(le_word(sect->sh_size) / le_word(sect->sh_entsize));
-
-		safe_call(ScanRelocSection(vsect, sectData, symTab, relTab, relCount));
+		// Sections patching the same section are scanned together, in order
+		size_t t = 0;
+		while (t < relocTargets.size() && relocTargets[t].sect != targetIndex) t ++;
+		if (t == relocTargets.size())
+		{
+			RelocTarget target;
+			target.sect = targetIndex;
+			relocTargets.push_back(target);
+		}
+		relocTargets[t].relSects.push_back(i);
 	}
 
+	// Each target section patches its own part of the image, so they are scanned in parallel
+	safe_call(pool.Run(ScanRelocTargetTask, this, relocTargets.size()));
+
 	// Scan for interworking thunks that need to be relocated
 	for (int i = 0; i < elfSymCount; i ++)
 	{
@@ -270,7 +312,7 @@ int ElfConvert::ScanRelocations()
 	return 0;
 }
 
-void ElfConvert::BuildRelocs(vector<bool>& map, int pos, int posEnd, u32& count)
+void ElfConvert::BuildRelocs(const RelocMap& map, int pos, int posEnd, u32& count)
 {
 	size_t curs = relocData.size();
 	pos    = (pos    - baseAddr) / 4;
@@ -279,8 +321,8 @@ void ElfConvert::BuildRelocs(vector<bool>& map, int pos, int posEnd, u32& count)
 	{
 		RelocEntry reloc;
 		u32 rs = 0, rp = 0;
-		while ((i < posEnd) && !map[i]) i ++, rs ++;
-		while ((i < posEnd) && map[i]) i ++, rp ++;
+		rs = map.RunLength(i, posEnd, false), i += rs;
+		rp = map.RunLength(i, posEnd, true), i += rp;
 
 		// Remove empty trailing relocations
 		if (i == posEnd && rs && !rp)
@@ -415,8 +457,8 @@ int ElfConvert::Convert()
 	dataStart = rodataStart + rodataSizeAlign;
 
 	// Create relocation bitmap
-	absRelocMap.assign((topAddr - baseAddr) / 4, false);
-	relRelocMap.assign((topAddr - baseAddr) / 4, false);
+	absRelocMap.Assign((topAddr - baseAddr) / 4);
+	relRelocMap.Assign((topAddr - baseAddr) / 4);
 
 	safe_call(ScanSections());
 	safe_call(ScanRelocations());
@@ -463,7 +505,7 @@ int ElfConvert::Convert()
 	return 0;
 }
 
-int ElfConvert::WriteExtHeader(const ByteBuffer& smdh, const char* romfsDir)
+int ElfConvert::WriteExtHeader(const ByteBuffer& smdh, const char* romfsDir, bool romfsDedup)
 {
 
 	u32 temp = fout.Tell();
@@ -485,9 +527,22 @@ int ElfConvert::WriteExtHeader(const ByteBuffer& smdh, const char* romfsDir)
 
 	if (romfsDir)
 	{
+		// stream the romfs into the output, so file data is never all held in memory
 		Romfs romfs;
-		safe_call(romfs.CreateRomfs(romfsDir));
-		fout.WriteRaw(romfs.data_blob(), romfs.data_size());
+		ByteBuffer block;
+		romfs.SetIsDeduplicated(romfsDedup);
+		safe_call(romfs.CreateRomfs(romfsDir, true));
+		safe_call(block.alloc_uninitialised(Romfs::kStreamBlockSize));
+
+		for (u64 pos = 0; pos < romfs.data_size(); pos += block.size())
+		{
+			if (romfs.data_size() - pos < block.size())
+				safe_call(block.alloc_uninitialised(romfs.data_size() - pos));
+
+			safe_call(romfs.ReadData(block.data(), block.size()));
+			if (!fout.WriteRaw(block.data_const(), block.size()))
+				die("Failed to write RomFS!");
+		}
 	}
 
 	return 0;
@@ -502,6 +557,7 @@ struct argInfo
 	char* longTitle;
 	char* authorName;
 	char* romfsDir;
+	bool romfsDedup;
 };
 
 int usage(const char* progName)
@@ -515,6 +571,7 @@ int usage(const char* progName)
 		"    --description=str : Sets decription in SMDH metadata.\n"
 		"    --author=str      : Sets author in SMDH metadata.\n"
 		"    --romfs=dir       : Embeds RomFS into the output file.\n"
+		"    --romfs-dedup=on  : Stores identical RomFS files once.\n"
 		, progName);
 	return 1;
 }
@@ -545,6 +602,8 @@ int parseArgs(argInfo& info, int argc, char* argv[])
 				info.authorName = FixMinGWPath(value);
 			else if (strcmp(arg, "romfs") == 0)
 				info.romfsDir = FixMinGWPath(value);
+			else if (strcmp(arg, "romfs-dedup") == 0 && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0))
+				info.romfsDedup = strcmp(value, "on") == 0;
 			else
 				return usage(argv[0]);
 		} else
@@ -616,25 +675,18 @@ int main(int argc, char* argv[])
 	argInfo args;
 	safe_call(parseArgs(args, argc, argv));
 
-	FILE *elf_file = fopen(args.elfFile, "rb");
-	if (!elf_file) die("Cannot open input file!");
-
-	fseek(elf_file, 0, SEEK_END);
-	size_t elfSize = ftell(elf_file);
-	rewind(elf_file);
-
-	byte_t* b = (byte_t*) malloc(elfSize);
-	if (!b) { fclose(elf_file); die("Cannot allocate memory!"); }
-
-	fread(b, 1, elfSize, elf_file);
-	fclose(elf_file);
+	// the elf is mapped privately, relocations are applied to it in place without touching the file,
+	// and only the pages of the segments and sections that are used get read
+	MappedFile elf;
+	if (elf.Open(args.elfFile, true) != 0) die("Cannot open input file!");
+	if (elf.size() < sizeof(Elf32_Ehdr)) die("Invalid ELF file!");
 
 	ByteBuffer smdh;
 	safe_call(createSmdh(args, smdh));
 
 	int rc = 0;
 	do {
-		ElfConvert cnv(args.outFile, b, 0);
+		ElfConvert cnv(args.outFile, elf.private_data(), 0);
 
 		bool hasExtHeader = smdh.size() || args.romfsDir;
 		if (hasExtHeader)
@@ -644,9 +696,8 @@ int main(int argc, char* argv[])
 		if (rc != 0) break;
 
 		if (hasExtHeader)
-			rc = cnv.WriteExtHeader(smdh, args.romfsDir);
+			rc = cnv.WriteExtHeader(smdh, args.romfsDir, args.romfsDedup);
 	} while(0);
-	free(b);
 
 	if (rc != 0)
 		remove(args.outFile);
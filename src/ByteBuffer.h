@@ -10,7 +10,8 @@ public:
 	ByteBuffer() :
 		data_(NULL),
 		size_(0),
-		apparent_size_(0)
+		apparent_size_(0),
+		dirty_size_(0)
 	{
 
 	}
@@ -25,7 +26,7 @@ public:
 		if (size > size_)
 		{
 			FreeMemory();
-			return AllocateMemory(size);
+			return AllocateMemory(size, true);
 		}
 		else
 		{
@@ -35,6 +36,26 @@ public:
 		return 0;
 	}
 
+	// like alloc(), but the contents are left uninitialised,
+	// for buffers that are completely overwritten straight away
+	int alloc_uninitialised(size_t size)
+	{
+		if (size > size_)
+		{
+			FreeMemory();
+			return AllocateMemory(size, false);
+		}
+		else
+		{
+			apparent_size_ = size;
+			if (dirty_size_ < size)
+			{
+				dirty_size_ = size;
+			}
+		}
+		return 0;
+	}
+
 	int OpenFile(const char* path)
 	{
 		FILE* fp;
@@ -49,11 +70,14 @@ public:
 		filesz = ftell(fp);
 		rewind(fp);
 
-		if (alloc(filesz) != 0)
+		// the file overwrites the buffer, only the slack after it needs clearing
+		if (alloc_uninitialised(filesz) != 0)
 		{
 			fclose(fp);
 			return 1;
 		}
+		memset(data_ + filesz, 0, size_ - filesz);
+		dirty_size_ = filesz;
 
 		for (filepos=0; filesz > kBlockSize; filesz -= kBlockSize, filepos += kBlockSize)
 		{
@@ -80,29 +104,40 @@ private:
 	byte_t* data_;
 	size_t size_;
 	size_t apparent_size_;
+	// everything from here to size_ is known to be zero, the
+	// contents of the buffer up to apparent_size_ are counted as dirty
+	size_t dirty_size_;
 
 	void FreeMemory()
 	{
 		free(data_);
+		data_ = NULL;
 		size_ = 0;
 		apparent_size_ = 0;
+		dirty_size_ = 0;
 	}
 
-	int AllocateMemory(size_t size)
+	int AllocateMemory(size_t size, bool zeroed)
 	{
 		size_ = align(size,0x1000);
 		apparent_size_ = size;
-		if ((data_ = (byte_t*)malloc(size_)) == NULL)
+		// calloc can hand back pages that are already zero without touching them
+		data_ = (byte_t*)(zeroed ? calloc(size_, 1) : malloc(size_));
+		if (data_ == NULL)
 		{
+			size_ = 0;
+			apparent_size_ = 0;
 			fprintf(stderr, "[ERROR] Cannot allocate memory!\n");
 			return 1;
 		}
-		ClearMemory();
+
+		dirty_size_ = zeroed ? apparent_size_ : size_;
 		return 0;
 	}
 
 	void ClearMemory()
 	{
-		memset(data_, 0, size_);
+		memset(data_, 0, dirty_size_);
+		dirty_size_ = apparent_size_;
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,236 @@
+#pragma once
+#include <cstdio>
+#include "types.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#endif
+
+// read-only view of a whole file, backed directly by the page cache
+class MappedFile
+{
+public:
+	MappedFile() :
+		data_(NULL),
+		size_(0),
+		is_private_(false),
+#ifdef _WIN32
+		file_(INVALID_HANDLE_VALUE),
+		mapping_(NULL)
+#else
+		fd_(-1)
+#endif
+	{
+
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	// a private mapping can be written to, the changes are copy-on-write and never reach the file
+	int Open(const char* path, bool is_private = false)
+	{
+		Close();
+
+#ifdef _WIN32
+		if ((file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE)
+#else
+		if ((fd_ = open(path, O_RDONLY)) < 0)
+#endif
+		{
+			return 1;
+		}
+
+		return Map(is_private);
+	}
+
+#ifdef _WIN32
+	// for oschar_t paths, which can hold names the ansi code page can't
+	int Open(const wchar_t* path, bool is_private = false)
+	{
+		Close();
+
+		if ((file_ = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE)
+		{
+			return 1;
+		}
+
+		return Map(is_private);
+	}
+#endif
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data_ != NULL)
+			UnmapViewOfFile(data_);
+		if (mapping_ != NULL)
+			CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+		mapping_ = NULL;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_ != NULL)
+			munmap((void*)data_, size_);
+		if (fd_ >= 0)
+			close(fd_);
+		fd_ = -1;
+#endif
+		data_ = NULL;
+		size_ = 0;
+	}
+
+	// write size bytes from offset in this file to the current position of out,
+	// letting the kernel copy the data directly between files where it can
+	int WriteTo(FILE* out, u64 offset, u64 size)
+	{
+		if (offset > size_ || size > size_ - offset)
+		{
+			return 1;
+		}
+
+#ifndef _WIN32
+		if (fflush(out) == 0)
+		{
+			int out_fd = fileno(out);
+			off_t in_pos = offset;
+			off_t out_pos = ftello(out);
+
+#ifdef HAVE_COPY_FILE_RANGE
+			while (size > 0)
+			{
+				ssize_t copied = copy_file_range(fd_, &in_pos, out_fd, &out_pos, size, 0);
+				if (copied <= 0)
+					break;
+				size -= copied;
+			}
+#endif
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+			// copy_file_range can be missing, or refuse to copy between filesystems
+			if (size > 0 && lseek(out_fd, out_pos, SEEK_SET) == out_pos)
+			{
+				while (size > 0)
+				{
+					ssize_t copied = sendfile(out_fd, fd_, &in_pos, size);
+					if (copied <= 0)
+						break;
+					size -= copied;
+				}
+				out_pos = lseek(out_fd, 0, SEEK_CUR);
+			}
+#endif
+
+			// keep the stream position in sync with what was written behind its back
+			if (fseeko(out, out_pos, SEEK_SET) != 0)
+			{
+				return 1;
+			}
+			offset = in_pos;
+		}
+#endif
+
+		// whatever the kernel couldn't copy is written from the mapping
+		if (size > 0 && fwrite(data_ + offset, 1, size, out) != size)
+		{
+			return 1;
+		}
+
+		return 0;
+	}
+
+	inline const u8* data() const { return data_; }
+	// the mapping when it was opened as private, NULL otherwise
+	inline u8* private_data() const { return is_private_ ? (u8*)data_ : NULL; }
+	inline u64 size() const { return size_; }
+#ifndef _WIN32
+	inline int fd() const { return fd_; }
+#endif
+
+private:
+	// map the file that was just opened
+	int Map(bool is_private)
+	{
+		is_private_ = is_private;
+
+#ifdef _WIN32
+		LARGE_INTEGER file_size;
+
+		if (!GetFileSizeEx(file_, &file_size))
+		{
+			Close();
+			return 1;
+		}
+		size_ = file_size.QuadPart;
+
+		// empty files can't be mapped, but there's nothing to read anyway
+		if (size_ == 0)
+		{
+			return 0;
+		}
+
+		if ((mapping_ = CreateFileMappingA(file_, NULL, is_private ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL)) == NULL || (data_ = (const u8*)MapViewOfFile(mapping_, is_private ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0)) == NULL)
+		{
+			Close();
+			return 1;
+		}
+#else
+		struct stat st;
+
+		if (fstat(fd_, &st) != 0)
+		{
+			Close();
+			return 1;
+		}
+		size_ = st.st_size;
+
+		// empty files can't be mapped, but there's nothing to read anyway
+		if (size_ == 0)
+		{
+			return 0;
+		}
+
+		void* map = is_private ? mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0) : mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+		if (map == MAP_FAILED)
+		{
+			Close();
+			return 1;
+		}
+		data_ = (const u8*)map;
+
+		// a shared mapping is read front to back, so let the kernel read ahead aggressively.
+		// private mappings are left alone, only the parts that are used get read
+		if (!is_private)
+		{
+			madvise(map, size_, MADV_SEQUENTIAL);
+		}
+#endif
+
+		return 0;
+	}
+
+	const u8* data_;
+	u64 size_;
+	bool is_private_;
+#ifdef _WIN32
+	HANDLE file_;
+	HANDLE mapping_;
+#else
+	int fd_;
+#endif
+
+	// not copyable, the mapping is owned
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
@@ -0,0 +1,270 @@
+#include "blz.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+Blz::Blz() :
+	is_compressed_(false)
+{
+}
+
+Blz::~Blz()
+{
+}
+
+int Blz::Compress(const u8* data, u32 size)
+{
+	is_compressed_ = false;
+
+	// the segments are parsed in parallel, each match finder starts with the window before its segment
+	safe_call(reversed_.alloc_uninitialised(size));
+	for (u32 i = 0; i < size; i++)
+	{
+		reversed_.data()[i] = data[size - 1 - i];
+	}
+	segment_.assign(align(size, kSegmentSize) / kSegmentSize, sSegment());
+	safe_call(pool_.Run(ParseSegmentTask, this, segment_.size()));
+
+	// join the segments into one stream of control bytes and tokens, in decompression order.
+	// the stream is cut where it is smallest compared to the data it produces, the rest is stored as it is.
+	// that also keeps the output from overtaking the input when it is decompressed in place
+	std::vector<u8> stream;
+	size_t control_pos = 0;
+	u32 group_size = 8;
+	u64 out_size = 0;
+	int64_t best_gain = 0;
+	size_t best_stream_size = 0;
+	u64 best_out_size = 0;
+	for (size_t i = 0; i < segment_.size(); i++)
+	{
+		const struct sSegment& segment = segment_[i];
+		size_t pos = 0;
+
+		for (size_t j = 0; j < segment.is_match.size(); j++)
+		{
+			if (group_size == 8)
+			{
+				control_pos = stream.size();
+				stream.push_back(0);
+				group_size = 0;
+			}
+
+			if (segment.is_match[j])
+			{
+				stream[control_pos] |= 0x80 >> group_size;
+				stream.push_back(segment.token[pos]);
+				stream.push_back(segment.token[pos + 1]);
+				out_size += (segment.token[pos] >> 4) + kMinMatchLen;
+				pos += 2;
+			}
+			else
+			{
+				stream.push_back(segment.token[pos]);
+				out_size += 1;
+				pos += 1;
+			}
+			group_size++;
+
+			int64_t gain = (int64_t)stream.size() - (int64_t)out_size;
+			if (gain < best_gain && stream.size() + kFooterSize + 3 <= kMaxCompressedSize)
+			{
+				best_gain = gain;
+				best_stream_size = stream.size();
+				best_out_size = out_size;
+			}
+		}
+	}
+	segment_.clear();
+
+	u32 raw_size = size - best_out_size;
+	u32 padding = align(raw_size + best_stream_size, 4) - (raw_size + best_stream_size);
+	u64 compressed_size = raw_size + best_stream_size + padding + kFooterSize;
+	if (best_stream_size == 0 || compressed_size >= size)
+	{
+		safe_call(data_.alloc_uninitialised(size));
+		if (size > 0)
+		{
+			memcpy(data_.data(), data, size);
+		}
+		return 0;
+	}
+
+	// the stream is read backwards from the footer
+	safe_call(data_.alloc_uninitialised(compressed_size));
+	u8* out = data_.data();
+	memcpy(out, data, raw_size);
+	for (size_t i = 0; i < best_stream_size; i++)
+	{
+		out[raw_size + best_stream_size - 1 - i] = stream[i];
+	}
+	memset(out + raw_size + best_stream_size, 0xFF, padding);
+
+	u32* footer = (u32*)(out + compressed_size - kFooterSize);
+	footer[0] = le_word((u32)(compressed_size - raw_size) | ((padding + kFooterSize) << 24));
+	footer[1] = le_word((u32)(size - compressed_size));
+
+	// a bad .code only shows up when the title is launched, so check it here
+	ByteBuffer check;
+	safe_call(Decompress(data_.data_const(), data_.size(), check));
+	if (check.size() != size || memcmp(check.data_const(), data, size) != 0) die("[ERROR] Compressed code doesn't decompress to the original.");
+
+	is_compressed_ = true;
+
+	return 0;
+}
+
+int Blz::Decompress(const u8* data, u32 size, ByteBuffer& out)
+{
+	if (size < kFooterSize) die("[ERROR] BLZ data is too small.");
+
+	const u32* footer = (const u32*)(data + size - kFooterSize);
+	u32 footer_size = le_word(footer[0]) >> 24;
+	u32 compressed_size = le_word(footer[0]) & kMaxCompressedSize;
+	u64 out_size = (u64)size + le_word(footer[1]);
+	if (footer_size < kFooterSize || compressed_size < footer_size || compressed_size > size || out_size > 0xFFFFFFFF) die("[ERROR] BLZ footer is invalid.");
+
+	safe_call(out.alloc_uninitialised(out_size));
+	u8* dst = out.data();
+	memcpy(dst, data, size);
+	memset(dst + size, 0, out_size - size);
+
+	// the data is written backwards from the end, matches copy from data that was already written
+	u32 index = size - footer_size;
+	u32 stop = size - compressed_size;
+	u64 out_pos = out_size;
+	while (index > stop)
+	{
+		u8 control = data[--index];
+
+		for (int i = 0; i < 8 && index > stop; i++, control <<= 1)
+		{
+			if (control & 0x80)
+			{
+				if (index - stop < 2) die("[ERROR] BLZ match is outside of the compressed data.");
+				index -= 2;
+
+				u32 value = data[index] | data[index + 1] << 8;
+				u32 len = (value >> 12) + kMinMatchLen;
+				u32 distance = (value & 0xFFF) + kMinMatchDistance;
+				if (len > out_pos || out_pos - 1 + distance >= out_size) die("[ERROR] BLZ match is outside of the decompressed data.");
+
+				for (u32 j = 0; j < len; j++, out_pos--)
+				{
+					dst[out_pos - 1] = dst[out_pos - 1 + distance];
+				}
+			}
+			else
+			{
+				if (out_pos == 0) die("[ERROR] BLZ literal is outside of the decompressed data.");
+				dst[--out_pos] = data[--index];
+			}
+
+			// the console decompresses in place, so the output can't overwrite input that hasn't been read yet
+			if (out_pos < index) die("[ERROR] BLZ data can't be decompressed in place.");
+		}
+	}
+
+	return 0;
+}
+
+void Blz::SetThreadNum(int thread_num)
+{
+	pool_.SetThreadNum(thread_num);
+}
+
+int Blz::ParseSegmentTask(void* arg, size_t index)
+{
+	((Blz*)arg)->ParseSegment(index);
+
+	return 0;
+}
+
+void Blz::ParseSegment(size_t index)
+{
+	const u8* data = reversed_.data_const();
+	u32 size = reversed_.size();
+	u32 start = index * kSegmentSize;
+	u32 end = (size - start > kSegmentSize) ? start + kSegmentSize : size;
+	struct sSegment& segment = segment_[index];
+
+	// hash chains of the positions before the one being parsed, positions are stored plus one so 0 ends a chain
+	std::vector<u32> head(1 << kHashBits, 0);
+	std::vector<u32> prev(kWindowSize, 0);
+	u32 inserted = (start > kMaxMatchDistance) ? start - kMaxMatchDistance : 0;
+
+	segment.token.reserve(end - start);
+	segment.is_match.reserve(end - start);
+
+	for (u32 pos = start; pos < end; )
+	{
+		for (; inserted < pos && inserted + kMinMatchLen <= size; inserted++)
+		{
+			u32 hash = Hash(inserted);
+			prev[inserted % kWindowSize] = head[hash];
+			head[hash] = inserted + 1;
+		}
+
+		u32 distance = 0;
+		u32 len = (pos + kMinMatchLen <= end) ? FindMatch(&head[0], &prev[0], pos, end, distance) : 0;
+
+		if (len >= kMinMatchLen)
+		{
+			u32 value = (len - kMinMatchLen) << 12 | (distance - kMinMatchDistance);
+			segment.token.push_back(value >> 8);
+			segment.token.push_back(value & 0xFF);
+			segment.is_match.push_back(1);
+			pos += len;
+		}
+		else
+		{
+			segment.token.push_back(data[pos]);
+			segment.is_match.push_back(0);
+			pos += 1;
+		}
+	}
+}
+
+u32 Blz::FindMatch(const u32* head, const u32* prev, u32 pos, u32 end, u32& distance) const
+{
+	const u8* data = reversed_.data_const();
+	u32 max_len = (end - pos < kMaxMatchLen) ? end - pos : kMaxMatchLen;
+	u32 best_len = 0;
+
+	u32 candidate = head[Hash(pos)];
+	for (u32 i = 0; candidate != 0 && i < kMaxChainLen; i++)
+	{
+		u32 match = candidate - 1;
+		if (pos - match > kMaxMatchDistance)
+			break;
+
+		// the two positions right before pos can't be referenced
+		if (pos - match >= kMinMatchDistance && data[match + best_len] == data[pos + best_len])
+		{
+			u32 len = 0;
+			while (len < max_len && data[match + len] == data[pos + len])
+				len++;
+
+			if (len > best_len)
+			{
+				best_len = len;
+				distance = pos - match;
+				if (len == max_len)
+					break;
+			}
+		}
+
+		// the chain only goes backwards, an older entry may have been overwritten by a newer position
+		candidate = prev[match % kWindowSize];
+		if (candidate > match)
+			break;
+	}
+
+	return best_len;
+}
+
+u32 Blz::Hash(u32 pos) const
+{
+	const u8* data = reversed_.data_const() + pos;
+
+	return ((data[0] << 16 | data[1] << 8 | data[2]) * 0x9E3779B1u) >> (32 - kHashBits);
+}
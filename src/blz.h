@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include "types.h"
+#include "ByteBuffer.h"
+#include "thread_pool.h"
+
+// backwards lz77, the compression used for the .code of a cxi.
+// data is decompressed in place from the end of the buffer towards the start,
+// the start of the data is left uncompressed where decompressing it in place would overwrite the input
+class Blz
+{
+public:
+	// the input is split into segments of this size, which are parsed in parallel
+	static const u32 kSegmentSize = 0x100000;
+
+	Blz();
+	~Blz();
+
+	// compress data, the output is checked by decompressing it again.
+	// if compressing doesn't make data smaller, is_compressed() is false and the output is a copy of it
+	int Compress(const u8* data, u32 size);
+	// decompress a compressed blob into out, returns non-zero if it is malformed
+	static int Decompress(const u8* data, u32 size, ByteBuffer& out);
+
+	// number of threads used for compressing, 0 uses one thread per cpu core
+	void SetThreadNum(int thread_num);
+
+	inline const u8* data_blob() const { return data_.data_const(); }
+	inline u32 data_size() const { return data_.size(); }
+	inline bool is_compressed() const { return is_compressed_; }
+private:
+	static const u32 kMinMatchLen = 3;
+	static const u32 kMaxMatchLen = 0xF + kMinMatchLen;
+	static const u32 kMinMatchDistance = 3;
+	static const u32 kMaxMatchDistance = 0xFFF + kMinMatchDistance;
+	// matches tried at each position, more rarely helps as the matches are short
+	static const u32 kMaxChainLen = 64;
+	static const u32 kHashBits = 15;
+	// positions in the hash chains are kept for this many bytes, more than the longest distance
+	static const u32 kWindowSize = 0x2000;
+	static const u32 kFooterSize = 8;
+	// the footer holds the size of the compressed part in 24 bits
+	static const u32 kMaxCompressedSize = 0xFFFFFF;
+
+	// tokens of one segment, in decompression order
+	struct sSegment
+	{
+		std::vector<u8> token; // a literal byte, or the two bytes of a match
+		std::vector<u8> is_match; // one flag per token
+	};
+
+	// input reversed, so matches refer backwards like in regular lz77
+	ByteBuffer reversed_;
+	std::vector<struct sSegment> segment_;
+	ByteBuffer data_;
+	bool is_compressed_;
+
+	ThreadPool pool_;
+
+	static int ParseSegmentTask(void* arg, size_t index);
+	void ParseSegment(size_t index);
+	// longest match for the data at pos, which can't extend past end
+	u32 FindMatch(const u32* head, const u32* prev, u32 pos, u32 end, u32& distance) const;
+	u32 Hash(u32 pos) const;
+};
@@ -1,6 +1,9 @@
+#include <cstdio>
 #include <cstring>
 #include "cia_header.h"
 
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+
 CiaHeader::CiaHeader()
 {
 	memset((u8*)&header_, 0, sizeof(struct sCiaHeader));
@@ -19,6 +22,15 @@ int CiaHeader::CreateCiaHeader()
 	return 0;
 }
 
+int CiaHeader::SetHeader(const u8* header)
+{
+	memcpy((u8*)&header_, header, sizeof(struct sCiaHeader));
+
+	if (le_word(header_.header_size) != sizeof(struct sCiaHeader)) die("[ERROR] Not a CIA file!");
+
+	return 0;
+}
+
 void CiaHeader::SetCertificateSize(u32 size)
 {
 	header_.certificate_size = le_word(size);
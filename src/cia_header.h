@@ -9,6 +9,8 @@ public:
 	~CiaHeader();
 
 	int CreateCiaHeader();
+	// Set header for parsing cia headers
+	int SetHeader(const u8* header);
 
 	inline const u8* data_blob() const { return (u8*)&header_; }
 	inline u32 data_size() const { return sizeof(struct sCiaHeader); }
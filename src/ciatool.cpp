@@ -1,9 +1,15 @@
 #include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
 #include "types.h"
 #include "ByteBuffer.h"
+#include "MappedFile.h"
 #include "cia_header.h"
 #include "es_ticket.h"
 #include "es_tmd.h"
+#include "thread_pool.h"
+#include "oschar.h"
 
 #include "ncch_header.h"
 #include "cxi_extended_header.h"
@@ -25,11 +31,18 @@ static inline char* FixMinGWPath(char* buf)
 #define FixMinGWPath(_arg) (_arg)
 #endif
 
+static const int kMaxContentNum = 64;
+
 struct sArgInfo
 {
-	const char *ncch_file;
 	const char *out_file;
 	const char *version;
+	bool encrypt;
+
+	// the first content is the cxi, the rest come from --content
+	const char *content_file[kMaxContentNum];
+	u16 content_index[kMaxContentNum];
+	int content_num;
 };
 
 class CiaBuilder
@@ -51,13 +64,25 @@ public:
 		SetDefaults();
 		safe_call(ImportContent());
 		safe_call(MakeTicket());
-		safe_call(MakeTmd());
 		safe_call(MakeHeader());
 		safe_call(WriteToFile());
 		return 0;
 	}
 
 private:
+	static const size_t kContentBlockSize = 0x400000;
+
+	struct sContent
+	{
+		const char* path;
+		u16 index;
+		u16 flags;
+		u64 size;
+		// from the start of the cia content
+		u64 offset;
+		u8 hash[Crypto::kSha256HashLen];
+	};
+
 	struct sTitleInfo
 	{
 		u32 save_size;
@@ -70,6 +95,9 @@ private:
 		u8 title_key[Crypto::kAes128KeySize];
 		u8 common_key[Crypto::kAes128KeySize];
 		u8 common_key_index;
+
+		// the contents are copied straight from their mapped ncch files when the cia is written
+		std::vector<struct sContent> contents;
 	};
 
 	struct sArgInfo args_;
@@ -82,7 +110,7 @@ private:
 	ByteBuffer certificates_;
 	EsTicket ticket_;
 	EsTmd tmd_;
-	ByteBuffer content_;
+	ThreadPool pool_;
 
 	void SetDefaults()
 	{
@@ -99,20 +127,42 @@ private:
 		// set ticket id, lets try to make it unique-ish
 		info_.ticket_id = 0;
 		u8 hash[Crypto::kSha1HashLen];
-		Crypto::Sha1((const u8*)args_.ncch_file, strlen(args_.ncch_file), hash);
+		Crypto::Sha1((const u8*)args_.content_file[0], strlen(args_.content_file[0]), hash);
 		for (int i = 0; i < 8; i++)
 		{
 			info_.ticket_id = (info_.ticket_id << 8) | hash[i];
 		}
 		
 
-		// content indexes, hard-coded to one content
+		// contents, ordered by index
+		info_.contents.clear();
+		for (int i = 0; i < args_.content_num; i++)
+		{
+			struct sContent content;
+			memset((u8*)&content, 0, sizeof(struct sContent));
+			content.path = args_.content_file[i];
+			content.index = args_.content_index[i];
+			content.flags = args_.encrypt ? EsTmd::ES_CONTENT_TYPE_ENCRYPTED : 0;
+			info_.contents.push_back(content);
+		}
+		std::stable_sort(info_.contents.begin(), info_.contents.end(), CompareContentIndex);
+
 		info_.indexes.clear();
-		info_.indexes.push_back(0);
+		for (size_t i = 0; i < info_.contents.size(); i++)
+		{
+			info_.indexes.push_back(info_.contents[i].index);
+		}
 
-		// set titlekey related stuff to dummy data
-		// content isn't going to be encrypted so this doesn't matter
-		memset(info_.title_key, 0, Crypto::kAes128KeySize);
+		// set titlekey related stuff, the common key is dummy data
+		// the title key only matters if the content is going to be encrypted
+		if (args_.encrypt)
+		{
+			GenerateTitleKey(info_.title_key);
+		}
+		else
+		{
+			memset(info_.title_key, 0, Crypto::kAes128KeySize);
+		}
 		memset(info_.common_key, 0, Crypto::kAes128KeySize);
 		info_.common_key_index = 0;
 
@@ -152,25 +202,87 @@ private:
 		memcpy(tmd_rsa_key_.priv_exponent, DUMMY_RSA_KEY.priv_exponent, Crypto::kRsa2048Size);
 	}
 
-	int ImportContent()
+	void GenerateTitleKey(u8 title_key[Crypto::kAes128KeySize])
 	{
-		NcchHeader ncch;
-		CxiExtendedHeader exheader;
+		FILE *fp;
 
-		safe_call(content_.OpenFile(args_.ncch_file));
+		if ((fp = fopen("/dev/urandom", "rb")) != NULL)
+		{
+			size_t read_size = fread(title_key, 1, Crypto::kAes128KeySize, fp);
+			fclose(fp);
+			if (read_size == Crypto::kAes128KeySize)
+			{
+				return;
+			}
+		}
 
-		// remember to add methods to the ncch hdr and exheader to allow deserialisation
-		// use those methods here to get what we need from them
-		safe_call(ncch.SetHeader(content_.data_const()));
+		// no system random source, derive one from the time and ticket id instead
+		u8 seed[sizeof(time_t) + sizeof(clock_t) + sizeof(u64)];
+		u8 hash[Crypto::kSha256HashLen];
+		time_t now = time(NULL);
+		clock_t ticks = clock();
+		memcpy(seed, &now, sizeof(time_t));
+		memcpy(seed + sizeof(time_t), &ticks, sizeof(clock_t));
+		memcpy(seed + sizeof(time_t) + sizeof(clock_t), &info_.ticket_id, sizeof(u64));
+		Crypto::Sha256(seed, sizeof(seed), hash);
+		memcpy(title_key, hash, Crypto::kAes128KeySize);
+	}
 
-		if (ncch.is_encrypted()) die("[ERROR] NCCH is encrypted!");
-		if (ncch.is_cfa()) die("[ERROR] NCCH is a CFA!");
-		if (ncch.exheader_size() == 0) die("[ERROR] CXI has no extended header!");
+	static bool CompareContentIndex(const struct sContent& a, const struct sContent& b)
+	{
+		return a.index < b.index;
+	}
 
-		safe_call(exheader.SetData(content_.data_const() + ncch.exheader_offset(), content_.data_const() + ncch.accessdesc_offset()));
+	int ImportContent()
+	{
+		u64 offset = 0;
 
-		info_.title_id = ncch.title_id();
-		info_.save_size = exheader.save_data_size();
+		for (size_t i = 0; i < info_.contents.size(); i++)
+		{
+			struct sContent& content = info_.contents[i];
+			NcchHeader ncch;
+			MappedFile file;
+
+			if (i > 0 && content.index == info_.contents[i - 1].index)
+			{
+				fprintf(stderr, "[ERROR] Content index %d is used more than once!\n", content.index);
+				return 1;
+			}
+
+			// the file is mapped rather than read, only the pages that are touched get loaded
+			if (file.Open(content.path) != 0)
+			{
+				fprintf(stderr, "[ERROR] Failed to open NCCH file: %s\n", content.path);
+				return 1;
+			}
+			content.size = file.size();
+
+			if (content.size < ncch.header_size()) die("[ERROR] NCCH is too small!");
+
+			// remember to add methods to the ncch hdr and exheader to allow deserialisation
+			// use those methods here to get what we need from them
+			safe_call(ncch.SetHeader(file.data()));
+			if (ncch.is_encrypted()) die("[ERROR] NCCH is encrypted!");
+
+			// the title is described by the cxi, content 0, the other contents can be cfas
+			if (i == 0)
+			{
+				CxiExtendedHeader exheader;
+
+				if (ncch.is_cfa()) die("[ERROR] NCCH is a CFA!");
+				if (ncch.exheader_size() == 0) die("[ERROR] CXI has no extended header!");
+				if (ncch.accessdesc_offset() + ncch.accessdesc_size() > content.size) die("[ERROR] NCCH is too small!");
+
+				safe_call(exheader.SetData(file.data() + ncch.exheader_offset(), file.data() + ncch.accessdesc_offset()));
+
+				info_.title_id = ncch.title_id();
+				info_.save_size = exheader.save_data_size();
+			}
+
+			// contents are stored back to back, each padded to the tmd content size alignment
+			content.offset = offset;
+			offset += align(content.size, Crypto::kAesBlockSize);
+		}
 
 		return 0;
 	}
@@ -196,7 +308,11 @@ private:
 		tmd_.SetTitleVersion(info_.title_version);
 		tmd_.SetCxiData(info_.save_size);
 		tmd_.SetTitleType(EsTmd::ES_TITLE_TYPE_CTR);
-		tmd_.AddContent(0, 0, 0, content_.data_const(), content_.size());
+		for (size_t i = 0; i < info_.contents.size(); i++)
+		{
+			const struct sContent& content = info_.contents[i];
+			tmd_.AddContent(content.index, content.index, content.flags, content.size, content.hash);
+		}
 
 		safe_call(tmd_.CreateTitleMetadata("Root-CA00000003-CP0000000b", tmd_rsa_key_.modulus, tmd_rsa_key_.priv_exponent));
 
@@ -207,9 +323,10 @@ private:
 	{
 		header_.SetCertificateSize(certificates_.size());
 		header_.SetTicketSize(ticket_.data_size());
-		header_.SetTmdSize(tmd_.data_size());
+		header_.SetTmdSize(EsTmd::GetDataSize(info_.indexes.size()));
 		header_.SetMetaSize(0);
-		header_.SetContentSize(content_.size());
+		const struct sContent& last = info_.contents.back();
+		header_.SetContentSize(last.offset + (args_.encrypt ? align(last.size, Crypto::kAesBlockSize) : last.size));
 		header_.SetContentMask(info_.indexes);
 
 		safe_call(header_.CreateCiaHeader());
@@ -217,15 +334,123 @@ private:
 		return 0;
 	}
 
+	static int WriteContentTask(void* arg, size_t index)
+	{
+		return ((CiaBuilder*)arg)->WriteContent(index);
+	}
+
+	// hash and (optionally) encrypt a content in one pass over the mapped file,
+	// unencrypted content is copied into the cia by the kernel
+	// each content is written through its own file handle, so they can be written in parallel
+	int WriteContent(size_t content_num)
+	{
+		struct sContent& content = info_.contents[content_num];
+		MappedFile file;
+		ByteBuffer block;
+		FILE *out;
+		struct Crypto::sSha256Context hash_ctx;
+		u8 iv[Crypto::kAesBlockSize];
+		int rc = 0;
+
+		if (file.Open(content.path) != 0 || file.size() != content.size)
+		{
+			fprintf(stderr, "[ERROR] Failed to open NCCH file: %s\n", content.path);
+			return 1;
+		}
+
+		if (args_.encrypt)
+		{
+			safe_call(block.alloc_uninitialised(kContentBlockSize));
+		}
+
+		if ((out = fopen(args_.out_file, "r+b")) == NULL)
+		{
+			die("[ERROR] Failed to open output file.");
+		}
+
+		// the iv is the content index
+		memset(iv, 0, Crypto::kAesBlockSize);
+		iv[0] = (content.index >> 8) & 0xff;
+		iv[1] = content.index & 0xff;
+
+		// the tmd hash covers the content padded to the aes block size,
+		// which encrypted content has to be padded to anyway
+		Crypto::Sha256Init(hash_ctx);
+		u64 padded_size = align(content.size, Crypto::kAesBlockSize);
+
+		// later contents can start past 2 GiB
+		if (os_fseek64(out, header_.content_offset() + content.offset, SEEK_SET) != 0)
+		{
+			rc = 1;
+		}
+		for (u64 pos = 0; pos < padded_size && rc == 0; pos += kContentBlockSize)
+		{
+			size_t size = (padded_size - pos < kContentBlockSize) ? padded_size - pos : kContentBlockSize;
+			size_t data_size = (content.size - pos < size) ? content.size - pos : size;
+			const u8* data = file.data() + pos;
+
+			// the padding at the end is the only data that isn't in the mapping
+			if (data_size < size)
+			{
+				static const u8 kZeroPadding[Crypto::kAesBlockSize] = { 0 };
+				Crypto::Sha256Update(hash_ctx, data, data_size);
+				Crypto::Sha256Update(hash_ctx, kZeroPadding, size - data_size);
+			}
+			else
+			{
+				Crypto::Sha256Update(hash_ctx, data, size);
+			}
+
+			if (args_.encrypt)
+			{
+				// encrypt straight out of the mapping, unless the data needs padding
+				if (data_size < size)
+				{
+					memcpy(block.data(), data, data_size);
+					memset(block.data() + data_size, 0, size - data_size);
+					data = block.data_const();
+				}
+				Crypto::AesCbcEncrypt(data, size, info_.title_key, iv, block.data());
+				if (fwrite(block.data_const(), 1, size, out) != size)
+				{
+					rc = 1;
+				}
+			}
+			else if (file.WriteTo(out, pos, data_size) != 0)
+			{
+				rc = 1;
+			}
+		}
+
+		if (fclose(out) != 0 || rc != 0)
+		{
+			die("[ERROR] Failed to write content.");
+		}
+
+		Crypto::Sha256Final(hash_ctx, content.hash);
+
+		return 0;
+	}
+
 	int WriteToFile()
 	{
 		FILE *fp;
+		int rc;
 
 		if ((fp = fopen(args_.out_file, "wb")) == NULL)
 		{
 			die("[ERROR] Failed to create output file.");
 		}
 
+		// write contents, this has to be done first as the tmd can't be signed until the contents are hashed
+		// every content gets its own thread, so the build takes about as long as the largest content
+		pool_.SetThreadNum(info_.contents.size());
+		if ((rc = pool_.Run(WriteContentTask, this, info_.contents.size())) != 0 || (rc = MakeTmd()) != 0)
+		{
+			fclose(fp);
+			return rc;
+		}
+
 		fseek(fp, 0, SEEK_SET);
 		fwrite(header_.data_blob(), 1, header_.data_size(), fp);
 
@@ -247,11 +472,7 @@ private:
 			fwrite(tmd_.data_blob(), 1, tmd_.data_size(), fp);
 		}
 
-		if (header_.content_size())
-		{
-			fseek(fp, header_.content_offset(), SEEK_SET);
-			fwrite(content_.data_const(), 1, content_.size(), fp);
-		}
+		fclose(fp);
 
 		return 0;
 	}
@@ -264,6 +485,8 @@ int usage(const char *prog_name)
 		"    %s input.cxi output.cia [options]\n\n"
 		"Options:\n"
 		"    --version=value    : Specify title version\n"
+		"    --encrypt          : Encrypt the content with a random title key\n"
+		"    --content=in:index : Add an NCCH (e.g. manual CFA) as content index\n"
 		, prog_name);
 	return 1;
 }
@@ -279,7 +502,9 @@ int ParseArgs(struct sArgInfo& info, int argc, char **argv)
 		return usage(argv[0]);
 	}
 
-	info.ncch_file = FixMinGWPath(argv[1]);
+	info.content_file[0] = FixMinGWPath(argv[1]);
+	info.content_index[0] = 0;
+	info.content_num = 1;
 	info.out_file = FixMinGWPath(argv[2]);
 
 	char *arg, *value;
@@ -298,6 +523,13 @@ int ParseArgs(struct sArgInfo& info, int argc, char **argv)
 		// get argument value
 		value = strchr(arg, '=');
 
+		// flags don't take a value
+		if (value == NULL && strcmp(arg, "encrypt") == 0)
+		{
+			info.encrypt = true;
+			continue;
+		}
+
 		// check there is actually an argument value
 		if (value == NULL || value[1] == '\0')
 		{
@@ -312,6 +544,34 @@ int ParseArgs(struct sArgInfo& info, int argc, char **argv)
 		{
 			info.version = value;
 		}
+		else if (strcmp(arg, "content") == 0)
+		{
+			// the index follows the last ':', so windows drive letters are left alone
+			char *index = strrchr(value, ':');
+			if (index == NULL || index == value || index[1] == '\0')
+			{
+				return usage(argv[0]);
+			}
+			*index++ = '\0';
+
+			if (info.content_num >= kMaxContentNum)
+			{
+				fprintf(stderr, "[ERROR] Too many contents (max %d)\n", kMaxContentNum);
+				return 1;
+			}
+			char *end;
+			errno = 0;
+			unsigned long content_index = strtoul(index, &end, 0);
+			if (*end != '\0' || errno != 0 || content_index > 0xFFFF)
+			{
+				fprintf(stderr, "[ERROR] Invalid content index: %s\n", index);
+				return 1;
+			}
+
+			info.content_file[info.content_num] = FixMinGWPath(value);
+			info.content_index[info.content_num] = content_index;
+			info.content_num++;
+		}
 		else
 		{
 			fprintf(stderr, "[ERROR] Unknown argument: %s\n", arg);
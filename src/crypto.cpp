@@ -1,4 +1,7 @@
 #include "crypto.h"
+#include "crypto_aes.h"
+#include "crypto_rsa.h"
+#include "crypto_sha256.h"
 #include "polarssl/aes.h"
 #include "polarssl/sha1.h"
 #include "polarssl/sha2.h"
@@ -11,65 +14,50 @@ void Crypto::Sha1(const u8* in, u32 size, u8 hash[kSha1HashLen])
 
 void Crypto::Sha256(const u8* in, u32 size, u8 hash[kSha256HashLen])
 {
-	sha2(in, size, hash, false);
+	CryptoSha256::Hash(in, size, hash);
 }
 
-void Crypto::AesCtr(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 ctr[kAesBlockSize], u8* out)
+void Crypto::Sha256Blocks(const u8* in, u32 block_size, u32 block_num, u8* hashes)
 {
-	aes_context ctx;
-	u8 block[kAesBlockSize] = { 0 };
-	size_t counterOffset = 0;
-
-	aes_setkey_enc(&ctx, key, 128);
-	aes_crypt_ctr(&ctx, size, &counterOffset, ctr, block, in, out);
+	CryptoSha256::HashBlocks(in, block_size, block_num, hashes);
 }
 
-void Crypto::AesCbcDecrypt(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 iv[kAesBlockSize], u8* out)
+void Crypto::Sha256Init(struct sSha256Context& ctx)
 {
-	aes_context ctx;
-	aes_setkey_dec(&ctx, key, 128);
-	aes_crypt_cbc(&ctx, AES_DECRYPT, size, iv, in, out);
+	CryptoSha256::Init(ctx);
 }
 
-void Crypto::AesCbcEncrypt(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 iv[kAesBlockSize], u8* out)
+void Crypto::Sha256Update(struct sSha256Context& ctx, const u8* in, u32 size)
 {
-	aes_context ctx;
-	aes_setkey_enc(&ctx, key, 128);
-	aes_crypt_cbc(&ctx, AES_ENCRYPT, size, iv, in, out);
+	CryptoSha256::Update(ctx, in, size);
 }
 
-int Crypto::SignRsa2048Sha256(const u8 modulus[kRsa2048Size], const u8 private_exponent[kRsa2048Size], const u8 hash[kSha256HashLen], u8 signature[kRsa2048Size])
+void Crypto::Sha256Final(struct sSha256Context& ctx, u8 hash[kSha256HashLen])
 {
-	int ret;
-	rsa_context ctx;
-	rsa_init(&ctx, RSA_PKCS_V15, 0);
+	CryptoSha256::Final(ctx, hash);
+}
 
-	ctx.len = kRsa2048Size;
-	mpi_read_binary(&ctx.D, private_exponent, ctx.len);
-	mpi_read_binary(&ctx.N, modulus, ctx.len);
+void Crypto::AesCtr(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 ctr[kAesBlockSize], u8* out)
+{
+	CryptoAes::Ctr(in, size, key, ctr, out);
+}
 
-	ret = rsa_rsassa_pkcs1_v15_sign(&ctx, RSA_PRIVATE, SIG_RSA_SHA256, kSha256HashLen, hash, signature);
+void Crypto::AesCbcDecrypt(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 iv[kAesBlockSize], u8* out)
+{
+	CryptoAes::CbcDecrypt(in, size, key, iv, out);
+}
 
-	rsa_free(&ctx);
+void Crypto::AesCbcEncrypt(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 iv[kAesBlockSize], u8* out)
+{
+	CryptoAes::CbcEncrypt(in, size, key, iv, out);
+}
 
-	return ret;
+int Crypto::SignRsa2048Sha256(const u8 modulus[kRsa2048Size], const u8 private_exponent[kRsa2048Size], const u8 hash[kSha256HashLen], u8 signature[kRsa2048Size])
+{
+	return CryptoRsa::Sign(modulus, private_exponent, kRsa2048Size, SIG_RSA_SHA256, kSha256HashLen, hash, signature);
 }
 
 int Crypto::VerifyRsa2048Sha256(const u8 modulus[kRsa2048Size], const u8 hash[kSha256HashLen], const u8 signature[kRsa2048Size])
 {
-	static const u8 public_exponent[3] = { 0x01, 0x00, 0x01 };
-
-	int ret;
-	rsa_context ctx;
-	rsa_init(&ctx, RSA_PKCS_V15, 0);
-
-	ctx.len = kRsa2048Size;
-	mpi_read_binary(&ctx.E, public_exponent, sizeof(public_exponent));
-	mpi_read_binary(&ctx.N, modulus, ctx.len);
-
-	ret = rsa_rsassa_pkcs1_v15_verify(&ctx, RSA_PUBLIC, SIG_RSA_SHA256, kSha256HashLen, hash, signature);
-
-	rsa_free(&ctx);
-
-	return ret;
+	return CryptoRsa::Verify(modulus, kRsa2048Size, SIG_RSA_SHA256, kSha256HashLen, hash, signature);
 }
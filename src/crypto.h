@@ -18,8 +18,21 @@ public:
 		u8 priv_exponent[Crypto::kRsa2048Size];
 	};
 
+	// state of a sha-256 hash computed over several updates
+	struct sSha256Context
+	{
+		u32 state[8];
+		u8 block[0x40];
+		u64 size;
+	};
+
 	static void Sha1(const u8* in, u32 size, u8 hash[kSha1HashLen]);
 	static void Sha256(const u8* in, u32 size, u8 hash[kSha256HashLen]);
+	// hash block_num consecutive blocks of block_size bytes into block_num hashes
+	static void Sha256Blocks(const u8* in, u32 block_size, u32 block_num, u8* hashes);
+	static void Sha256Init(struct sSha256Context& ctx);
+	static void Sha256Update(struct sSha256Context& ctx, const u8* in, u32 size);
+	static void Sha256Final(struct sSha256Context& ctx, u8 hash[kSha256HashLen]);
 
 	static void AesCtr(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 ctr[kAesBlockSize], u8* out);
 	static void AesCbcDecrypt(const u8* in, u32 size, const u8 key[kAes128KeySize], u8 iv[kAesBlockSize], u8* out);
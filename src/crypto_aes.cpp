@@ -0,0 +1,485 @@
+#include <cstring>
+#include "crypto_aes.h"
+#include "polarssl/aes.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRYPTO_AES_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const int kRoundKeyNum = 11;
+
+static const u32 kScheduleAesNiEnc = BIT(0);
+static const u32 kScheduleAesNiDec = BIT(1);
+static const u32 kSchedulePortableEnc = BIT(2);
+static const u32 kSchedulePortableDec = BIT(3);
+
+// expanded key schedules of the last key used on this thread,
+// so repeated calls with the same key skip the key expansion
+struct sKeyCache
+{
+	u8 key[CryptoAes::kKeySize];
+	u32 ready;
+	u8 aesni_enc[kRoundKeyNum][CryptoAes::kBlockSize];
+	u8 aesni_dec[kRoundKeyNum][CryptoAes::kBlockSize];
+	aes_context portable_enc;
+	aes_context portable_dec;
+};
+
+static __thread struct sKeyCache key_cache;
+
+static struct sKeyCache* GetKeyCache(const u8 key[CryptoAes::kKeySize])
+{
+	if (key_cache.ready == 0 || memcmp(key_cache.key, key, CryptoAes::kKeySize) != 0)
+	{
+		memcpy(key_cache.key, key, CryptoAes::kKeySize);
+		key_cache.ready = 0;
+	}
+	return &key_cache;
+}
+
+static inline u64 load_be64(const u8* p)
+{
+	u64 x = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		x = (x << 8) | p[i];
+	}
+	return x;
+}
+
+static inline void store_be64(u8* p, u64 x)
+{
+	for (int i = 7; i >= 0; i--)
+	{
+		p[i] = x & 0xFF;
+		x >>= 8;
+	}
+}
+
+static void CtrPortable(struct sKeyCache* cache, const u8* in, size_t size, u8 ctr[CryptoAes::kBlockSize], u8* out)
+{
+	u8 block[CryptoAes::kBlockSize] = { 0 };
+	size_t counter_offset = 0;
+
+	if (!(cache->ready & kSchedulePortableEnc))
+	{
+		aes_setkey_enc(&cache->portable_enc, cache->key, 128);
+		cache->ready |= kSchedulePortableEnc;
+	}
+	aes_crypt_ctr(&cache->portable_enc, size, &counter_offset, ctr, block, in, out);
+}
+
+static void CbcEncryptPortable(struct sKeyCache* cache, const u8* in, size_t size, u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	if (!(cache->ready & kSchedulePortableEnc))
+	{
+		aes_setkey_enc(&cache->portable_enc, cache->key, 128);
+		cache->ready |= kSchedulePortableEnc;
+	}
+	aes_crypt_cbc(&cache->portable_enc, AES_ENCRYPT, size, iv, in, out);
+}
+
+static void CbcDecryptPortable(struct sKeyCache* cache, const u8* in, size_t size, u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	if (!(cache->ready & kSchedulePortableDec))
+	{
+		aes_setkey_dec(&cache->portable_dec, cache->key, 128);
+		cache->ready |= kSchedulePortableDec;
+	}
+	aes_crypt_cbc(&cache->portable_dec, AES_DECRYPT, size, iv, in, out);
+}
+
+#ifdef CRYPTO_AES_X86
+__attribute__((target("aes")))
+static inline __m128i ExpandKeyStep(__m128i key, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xFF);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+#define AESNI_EXPAND_KEY(i, rcon) rk[i] = ExpandKeyStep(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+__attribute__((target("aes")))
+static void ExpandKeyAesNi(struct sKeyCache* cache)
+{
+	__m128i rk[kRoundKeyNum];
+
+	rk[0] = _mm_loadu_si128((const __m128i*)cache->key);
+	AESNI_EXPAND_KEY(1, 0x01);
+	AESNI_EXPAND_KEY(2, 0x02);
+	AESNI_EXPAND_KEY(3, 0x04);
+	AESNI_EXPAND_KEY(4, 0x08);
+	AESNI_EXPAND_KEY(5, 0x10);
+	AESNI_EXPAND_KEY(6, 0x20);
+	AESNI_EXPAND_KEY(7, 0x40);
+	AESNI_EXPAND_KEY(8, 0x80);
+	AESNI_EXPAND_KEY(9, 0x1B);
+	AESNI_EXPAND_KEY(10, 0x36);
+
+	// the equivalent inverse cipher uses the round keys in reverse, with InvMixColumns applied
+	for (int i = 0; i < kRoundKeyNum; i++)
+	{
+		_mm_storeu_si128((__m128i*)cache->aesni_enc[i], rk[i]);
+		if (i == 0 || i == kRoundKeyNum - 1)
+			_mm_storeu_si128((__m128i*)cache->aesni_dec[kRoundKeyNum - 1 - i], rk[i]);
+		else
+			_mm_storeu_si128((__m128i*)cache->aesni_dec[kRoundKeyNum - 1 - i], _mm_aesimc_si128(rk[i]));
+	}
+
+	cache->ready |= kScheduleAesNiEnc | kScheduleAesNiDec;
+}
+
+#undef AESNI_EXPAND_KEY
+
+__attribute__((target("aes")))
+static inline void LoadRoundKeys(const u8 round_keys[kRoundKeyNum][CryptoAes::kBlockSize], __m128i rk[kRoundKeyNum])
+{
+	for (int i = 0; i < kRoundKeyNum; i++)
+	{
+		rk[i] = _mm_loadu_si128((const __m128i*)round_keys[i]);
+	}
+}
+
+__attribute__((target("aes")))
+static inline __m128i EncryptBlockAesNi(__m128i x, const __m128i rk[kRoundKeyNum])
+{
+	x = _mm_xor_si128(x, rk[0]);
+	for (int r = 1; r < kRoundKeyNum - 1; r++)
+	{
+		x = _mm_aesenc_si128(x, rk[r]);
+	}
+	return _mm_aesenclast_si128(x, rk[kRoundKeyNum - 1]);
+}
+
+__attribute__((target("aes")))
+static inline __m128i DecryptBlockAesNi(__m128i x, const __m128i rk[kRoundKeyNum])
+{
+	x = _mm_xor_si128(x, rk[0]);
+	for (int r = 1; r < kRoundKeyNum - 1; r++)
+	{
+		x = _mm_aesdec_si128(x, rk[r]);
+	}
+	return _mm_aesdeclast_si128(x, rk[kRoundKeyNum - 1]);
+}
+
+__attribute__((target("aes,ssse3")))
+static void CtrAesNi(struct sKeyCache* cache, const u8* in, size_t size, u8 ctr[CryptoAes::kBlockSize], u8* out)
+{
+	const __m128i byte_swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i rk[kRoundKeyNum];
+	__m128i x[CryptoAes::kPipelineBlockNum];
+	u64 ctr_hi = load_be64(ctr);
+	u64 ctr_lo = load_be64(ctr + 8);
+
+	if (!(cache->ready & kScheduleAesNiEnc))
+		ExpandKeyAesNi(cache);
+	LoadRoundKeys(cache->aesni_enc, rk);
+
+	for (; size >= (size_t)CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum; size -= CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum)
+	{
+		if (ctr_lo <= ~0ULL - CryptoAes::kPipelineBlockNum)
+		{
+			// the low half doesn't carry, so the counters can be added in vector registers
+			__m128i base = _mm_set_epi64x(ctr_hi, ctr_lo);
+			#pragma GCC unroll 8
+			for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+			{
+				x[i] = _mm_xor_si128(_mm_shuffle_epi8(_mm_add_epi64(base, _mm_set_epi64x(0, i)), byte_swap), rk[0]);
+			}
+			ctr_lo += CryptoAes::kPipelineBlockNum;
+		}
+		else
+		{
+			for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+			{
+				x[i] = _mm_xor_si128(_mm_shuffle_epi8(_mm_set_epi64x(ctr_hi, ctr_lo), byte_swap), rk[0]);
+				if (++ctr_lo == 0)
+					ctr_hi++;
+			}
+		}
+		for (int r = 1; r < kRoundKeyNum - 1; r++)
+		{
+			#pragma GCC unroll 8
+			for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+			{
+				x[i] = _mm_aesenc_si128(x[i], rk[r]);
+			}
+		}
+		#pragma GCC unroll 8
+		for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+		{
+			x[i] = _mm_aesenclast_si128(x[i], rk[kRoundKeyNum - 1]);
+			_mm_storeu_si128((__m128i*)out, _mm_xor_si128(x[i], _mm_loadu_si128((const __m128i*)in)));
+			in += CryptoAes::kBlockSize;
+			out += CryptoAes::kBlockSize;
+		}
+	}
+
+	while (size > 0)
+	{
+		__m128i keystream = EncryptBlockAesNi(_mm_shuffle_epi8(_mm_set_epi64x(ctr_hi, ctr_lo), byte_swap), rk);
+		if (++ctr_lo == 0)
+			ctr_hi++;
+
+		if (size >= (size_t)CryptoAes::kBlockSize)
+		{
+			_mm_storeu_si128((__m128i*)out, _mm_xor_si128(keystream, _mm_loadu_si128((const __m128i*)in)));
+			in += CryptoAes::kBlockSize;
+			out += CryptoAes::kBlockSize;
+			size -= CryptoAes::kBlockSize;
+		}
+		else
+		{
+			u8 block[CryptoAes::kBlockSize];
+			_mm_storeu_si128((__m128i*)block, keystream);
+			for (size_t i = 0; i < size; i++)
+			{
+				out[i] = in[i] ^ block[i];
+			}
+			size = 0;
+		}
+	}
+
+	store_be64(ctr, ctr_hi);
+	store_be64(ctr + 8, ctr_lo);
+}
+
+__attribute__((target("aes")))
+static void CbcEncryptAesNi(struct sKeyCache* cache, const u8* in, size_t size, u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	__m128i rk[kRoundKeyNum];
+
+	if (!(cache->ready & kScheduleAesNiEnc))
+		ExpandKeyAesNi(cache);
+	LoadRoundKeys(cache->aesni_enc, rk);
+
+	// each block depends on the last, so encryption can't be pipelined
+	__m128i chain = _mm_loadu_si128((const __m128i*)iv);
+	for (; size > 0; size -= CryptoAes::kBlockSize)
+	{
+		chain = EncryptBlockAesNi(_mm_xor_si128(chain, _mm_loadu_si128((const __m128i*)in)), rk);
+		_mm_storeu_si128((__m128i*)out, chain);
+		in += CryptoAes::kBlockSize;
+		out += CryptoAes::kBlockSize;
+	}
+	_mm_storeu_si128((__m128i*)iv, chain);
+}
+
+__attribute__((target("aes")))
+static void CbcDecryptAesNi(struct sKeyCache* cache, const u8* in, size_t size, u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	__m128i rk[kRoundKeyNum];
+	__m128i x[CryptoAes::kPipelineBlockNum];
+	__m128i c[CryptoAes::kPipelineBlockNum];
+
+	if (!(cache->ready & kScheduleAesNiDec))
+		ExpandKeyAesNi(cache);
+	LoadRoundKeys(cache->aesni_dec, rk);
+
+	__m128i chain = _mm_loadu_si128((const __m128i*)iv);
+	for (; size >= (size_t)CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum; size -= CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum)
+	{
+		#pragma GCC unroll 8
+		for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+		{
+			c[i] = _mm_loadu_si128((const __m128i*)(in + CryptoAes::kBlockSize * i));
+			x[i] = _mm_xor_si128(c[i], rk[0]);
+		}
+		for (int r = 1; r < kRoundKeyNum - 1; r++)
+		{
+			#pragma GCC unroll 8
+			for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+			{
+				x[i] = _mm_aesdec_si128(x[i], rk[r]);
+			}
+		}
+		#pragma GCC unroll 8
+		for (int i = 0; i < CryptoAes::kPipelineBlockNum; i++)
+		{
+			x[i] = _mm_aesdeclast_si128(x[i], rk[kRoundKeyNum - 1]);
+			_mm_storeu_si128((__m128i*)(out + CryptoAes::kBlockSize * i), _mm_xor_si128(x[i], i == 0 ? chain : c[i - 1]));
+		}
+		chain = c[CryptoAes::kPipelineBlockNum - 1];
+		in += CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum;
+		out += CryptoAes::kBlockSize * CryptoAes::kPipelineBlockNum;
+	}
+
+	for (; size > 0; size -= CryptoAes::kBlockSize)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)in);
+		_mm_storeu_si128((__m128i*)out, _mm_xor_si128(DecryptBlockAesNi(block, rk), chain));
+		chain = block;
+		in += CryptoAes::kBlockSize;
+		out += CryptoAes::kBlockSize;
+	}
+	_mm_storeu_si128((__m128i*)iv, chain);
+}
+
+static bool HasAesNi()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	// SSSE3 & AES
+	return (ecx & BIT(9)) && (ecx & BIT(25));
+}
+#endif
+
+static void CtrWith(CryptoAes::Backend backend, const u8* in, size_t size, const u8 key[CryptoAes::kKeySize], u8 ctr[CryptoAes::kBlockSize], u8* out)
+{
+#ifdef CRYPTO_AES_X86
+	if (backend == CryptoAes::BACKEND_AESNI)
+	{
+		CtrAesNi(GetKeyCache(key), in, size, ctr, out);
+		return;
+	}
+#endif
+	CtrPortable(GetKeyCache(key), in, size, ctr, out);
+}
+
+static void CbcEncryptWith(CryptoAes::Backend backend, const u8* in, size_t size, const u8 key[CryptoAes::kKeySize], u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	// polarssl rejects partial blocks, and so do we
+	if (size % CryptoAes::kBlockSize)
+		return;
+
+#ifdef CRYPTO_AES_X86
+	if (backend == CryptoAes::BACKEND_AESNI)
+	{
+		CbcEncryptAesNi(GetKeyCache(key), in, size, iv, out);
+		return;
+	}
+#endif
+	CbcEncryptPortable(GetKeyCache(key), in, size, iv, out);
+}
+
+static void CbcDecryptWith(CryptoAes::Backend backend, const u8* in, size_t size, const u8 key[CryptoAes::kKeySize], u8 iv[CryptoAes::kBlockSize], u8* out)
+{
+	if (size % CryptoAes::kBlockSize)
+		return;
+
+#ifdef CRYPTO_AES_X86
+	if (backend == CryptoAes::BACKEND_AESNI)
+	{
+		CbcDecryptAesNi(GetKeyCache(key), in, size, iv, out);
+		return;
+	}
+#endif
+	CbcDecryptPortable(GetKeyCache(key), in, size, iv, out);
+}
+
+static CryptoAes::Backend SelectBackend()
+{
+#ifdef CRYPTO_AES_X86
+	if (HasAesNi() && CryptoAes::SelfTest(CryptoAes::BACKEND_AESNI) == 0)
+		return CryptoAes::BACKEND_AESNI;
+#endif
+	return CryptoAes::BACKEND_PORTABLE;
+}
+
+// selected once at startup, before any threads are created
+static const CryptoAes::Backend kBackend = SelectBackend();
+
+void CryptoAes::Ctr(const u8* in, size_t size, const u8 key[kKeySize], u8 ctr[kBlockSize], u8* out)
+{
+	CtrWith(kBackend, in, size, key, ctr, out);
+}
+
+void CryptoAes::CbcEncrypt(const u8* in, size_t size, const u8 key[kKeySize], u8 iv[kBlockSize], u8* out)
+{
+	CbcEncryptWith(kBackend, in, size, key, iv, out);
+}
+
+void CryptoAes::CbcDecrypt(const u8* in, size_t size, const u8 key[kKeySize], u8 iv[kBlockSize], u8* out)
+{
+	CbcDecryptWith(kBackend, in, size, key, iv, out);
+}
+
+CryptoAes::Backend CryptoAes::backend()
+{
+	return kBackend;
+}
+
+const char* CryptoAes::backend_name()
+{
+	switch (kBackend)
+	{
+	case (BACKEND_AESNI) :
+		return "aes-ni";
+	default:
+		return "portable";
+	}
+}
+
+int CryptoAes::SelfTest(Backend backend)
+{
+	// FIPS-197 appendix C.1
+	static const u8 kKey[kKeySize] =
+	{
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F
+	};
+	static const u8 kPlaintext[kBlockSize] =
+	{
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+	};
+	static const u8 kCiphertext[kBlockSize] =
+	{
+		0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A
+	};
+
+	u8 iv[kBlockSize];
+	u8 block[kBlockSize];
+
+	memset(iv, 0, kBlockSize);
+	CbcEncryptWith(backend, kPlaintext, kBlockSize, kKey, iv, block);
+	if (memcmp(block, kCiphertext, kBlockSize) != 0)
+		return 1;
+
+	memset(iv, 0, kBlockSize);
+	CbcDecryptWith(backend, kCiphertext, kBlockSize, kKey, iv, block);
+	if (memcmp(block, kPlaintext, kBlockSize) != 0)
+		return 1;
+
+	// compare multi block messages against polarssl, with a counter that carries into the high half
+	u8 data[kBlockSize * 19 + 7];
+	u8 result[sizeof(data)];
+	u8 reference[sizeof(data)];
+	u8 state[kBlockSize];
+	u8 reference_state[kBlockSize];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (u8)(i * 0x3B + (i >> 4));
+	}
+
+	memset(state, 0xFF, kBlockSize);
+	state[0] = 0x12;
+	state[kBlockSize - 1] = 0xF9;
+	memcpy(reference_state, state, kBlockSize);
+	CtrWith(backend, data, sizeof(data), kKey, state, result);
+	CtrWith(BACKEND_PORTABLE, data, sizeof(data), kKey, reference_state, reference);
+	if (memcmp(result, reference, sizeof(data)) != 0 || memcmp(state, reference_state, kBlockSize) != 0)
+		return 1;
+
+	size_t cbc_size = sizeof(data) - (sizeof(data) % kBlockSize);
+	memcpy(state, data, kBlockSize);
+	memcpy(reference_state, data, kBlockSize);
+	CbcEncryptWith(backend, data, cbc_size, kKey, state, result);
+	CbcEncryptWith(BACKEND_PORTABLE, data, cbc_size, kKey, reference_state, reference);
+	if (memcmp(result, reference, cbc_size) != 0 || memcmp(state, reference_state, kBlockSize) != 0)
+		return 1;
+
+	memcpy(state, data, kBlockSize);
+	memcpy(reference_state, data, kBlockSize);
+	CbcDecryptWith(backend, data, cbc_size, kKey, state, result);
+	CbcDecryptWith(BACKEND_PORTABLE, data, cbc_size, kKey, reference_state, reference);
+	if (memcmp(result, reference, cbc_size) != 0 || memcmp(state, reference_state, kBlockSize) != 0)
+		return 1;
+
+	return 0;
+}
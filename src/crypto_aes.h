@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include "types.h"
+
+// AES-128 implementations used by Crypto, selected at runtime for the host cpu
+class CryptoAes
+{
+public:
+	static const int kKeySize = 0x10;
+	static const int kBlockSize = 0x10;
+
+	enum Backend
+	{
+		BACKEND_PORTABLE,
+		BACKEND_AESNI
+	};
+
+	// number of blocks the AES-NI kernels keep in flight
+	static const int kPipelineBlockNum = 8;
+
+	// ctr is advanced by one for every (partial) block processed
+	static void Ctr(const u8* in, size_t size, const u8 key[kKeySize], u8 ctr[kBlockSize], u8* out);
+	// size must be a multiple of the block size, iv is updated for chaining
+	static void CbcEncrypt(const u8* in, size_t size, const u8 key[kKeySize], u8 iv[kBlockSize], u8* out);
+	static void CbcDecrypt(const u8* in, size_t size, const u8 key[kKeySize], u8 iv[kBlockSize], u8* out);
+
+	// selected implementation
+	static Backend backend();
+	static const char* backend_name();
+
+	// known answer test of an implementation, returns 0 if it passes
+	static int SelfTest(Backend backend);
+};
@@ -0,0 +1,246 @@
+#include <cstring>
+#include <pthread.h>
+#include "crypto_rsa.h"
+#include "polarssl/rsa.h"
+
+// parsed key, kept until the process exits
+struct sRsaKey
+{
+	u8 modulus[CryptoRsa::kMaxKeySize];
+	u8 priv_exp[CryptoRsa::kMaxKeySize];
+	size_t size;
+	rsa_context ctx;
+	struct sRsaKey* next;
+};
+
+static struct sRsaKey* key_list = NULL;
+
+// public key, only ever read once it is in the list
+struct sRsaPublicKey
+{
+	u8 modulus[CryptoRsa::kMaxKeySize];
+	size_t size;
+	rsa_context ctx;
+	struct sRsaPublicKey* next;
+};
+
+static struct sRsaPublicKey* public_key_list = NULL;
+
+// rsa_context caches the montgomery constants of its moduli on first use,
+// so a private key is only ever used by one thread at a time.
+// this also guards both key lists
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// compute the CRT exponents once P and Q are known, and check that they really are the factors of N
+static int PrepareCrt(rsa_context* ctx)
+{
+	int ret;
+	mpi t, p1, q1;
+
+	mpi_init(&t); mpi_init(&p1); mpi_init(&q1);
+
+	MPI_CHK(mpi_mul_mpi(&t, &ctx->P, &ctx->Q));
+	if (mpi_cmp_int(&ctx->P, 1) <= 0 || mpi_cmp_int(&ctx->Q, 1) <= 0 || mpi_cmp_mpi(&t, &ctx->N) != 0)
+	{
+		ret = POLARSSL_ERR_RSA_KEY_CHECK_FAILED;
+		goto cleanup;
+	}
+
+	MPI_CHK(mpi_sub_int(&p1, &ctx->P, 1));
+	MPI_CHK(mpi_sub_int(&q1, &ctx->Q, 1));
+	MPI_CHK(mpi_mod_mpi(&ctx->DP, &ctx->D, &p1));
+	MPI_CHK(mpi_mod_mpi(&ctx->DQ, &ctx->D, &q1));
+	MPI_CHK(mpi_inv_mod(&ctx->QP, &ctx->Q, &ctx->P));
+
+cleanup:
+	mpi_free(&t); mpi_free(&p1); mpi_free(&q1);
+
+	return ret;
+}
+
+// recover P and Q from N, D and E.
+// D*E - 1 is a multiple of lcm(P-1, Q-1), so writing it as 2^s * r, g^(r * 2^i) mod N
+// eventually reaches a square root of 1 other than +-1 for most g, and gcd(root - 1, N) is a factor.
+static int FactorModulus(rsa_context* ctx)
+{
+	int ret;
+	size_t s, i;
+	t_sint g;
+	mpi k, r, n1, y, x;
+
+	mpi_init(&k); mpi_init(&r); mpi_init(&n1); mpi_init(&y); mpi_init(&x);
+
+	MPI_CHK(mpi_mul_mpi(&k, &ctx->D, &ctx->E));
+	MPI_CHK(mpi_sub_int(&k, &k, 1));
+	MPI_CHK(mpi_sub_int(&n1, &ctx->N, 1));
+	if (mpi_cmp_int(&k, 0) <= 0 || mpi_get_bit(&k, 0) != 0)
+	{
+		ret = POLARSSL_ERR_RSA_KEY_CHECK_FAILED;
+		goto cleanup;
+	}
+
+	s = mpi_lsb(&k);
+	MPI_CHK(mpi_copy(&r, &k));
+	MPI_CHK(mpi_shift_r(&r, s));
+
+	ret = POLARSSL_ERR_RSA_KEY_CHECK_FAILED;
+	for (g = 2; g < 100 && ret != 0; g++)
+	{
+		MPI_CHK(mpi_lset(&x, g));
+		MPI_CHK(mpi_exp_mod(&y, &x, &r, &ctx->N, &ctx->RN));
+		if (mpi_cmp_int(&y, 1) == 0 || mpi_cmp_mpi(&y, &n1) == 0)
+			continue;
+
+		for (i = 0; i < s; i++)
+		{
+			MPI_CHK(mpi_mul_mpi(&x, &y, &y));
+			MPI_CHK(mpi_mod_mpi(&x, &x, &ctx->N));
+
+			if (mpi_cmp_int(&x, 1) == 0)
+			{
+				// y is a non-trivial square root of 1
+				MPI_CHK(mpi_sub_int(&y, &y, 1));
+				MPI_CHK(mpi_gcd(&ctx->P, &y, &ctx->N));
+				MPI_CHK(mpi_div_mpi(&ctx->Q, &x, &ctx->N, &ctx->P));
+				ret = mpi_cmp_int(&x, 0) == 0 ? 0 : POLARSSL_ERR_RSA_KEY_CHECK_FAILED;
+				break;
+			}
+			if (mpi_cmp_mpi(&x, &n1) == 0)
+				break;
+
+			MPI_CHK(mpi_copy(&y, &x));
+		}
+	}
+
+cleanup:
+	mpi_free(&k); mpi_free(&r); mpi_free(&n1); mpi_free(&y); mpi_free(&x);
+
+	return ret;
+}
+
+static struct sRsaKey* GetKey(const u8* modulus, const u8* priv_exp, const u8* p, const u8* q, size_t key_size)
+{
+	struct sRsaKey* key;
+
+	for (key = key_list; key != NULL; key = key->next)
+	{
+		if (key->size == key_size && memcmp(key->modulus, modulus, key_size) == 0 && memcmp(key->priv_exp, priv_exp, key_size) == 0)
+			return key;
+	}
+
+	key = new struct sRsaKey;
+	memcpy(key->modulus, modulus, key_size);
+	memcpy(key->priv_exp, priv_exp, key_size);
+	key->size = key_size;
+
+	rsa_init(&key->ctx, RSA_PKCS_V15, 0);
+	key->ctx.len = key_size;
+	if (mpi_read_binary(&key->ctx.N, modulus, key_size) != 0 || mpi_read_binary(&key->ctx.D, priv_exp, key_size) != 0 || mpi_lset(&key->ctx.E, CryptoRsa::kPublicExponent) != 0)
+	{
+		rsa_free(&key->ctx);
+		delete key;
+		return NULL;
+	}
+
+	int ret;
+	if (p != NULL && q != NULL)
+	{
+		ret = mpi_read_binary(&key->ctx.P, p, key_size / 2);
+		if (ret == 0)
+			ret = mpi_read_binary(&key->ctx.Q, q, key_size / 2);
+	}
+	else
+	{
+		ret = FactorModulus(&key->ctx);
+	}
+	if (ret == 0)
+		ret = PrepareCrt(&key->ctx);
+
+	// without the primes rsa_private falls back to a full width exponentiation with D
+	if (ret != 0)
+	{
+		mpi_lset(&key->ctx.P, 0);
+		mpi_lset(&key->ctx.Q, 0);
+	}
+
+	key->next = key_list;
+	key_list = key;
+
+	return key;
+}
+
+static int SignWithKey(const u8* modulus, const u8* priv_exp, const u8* p, const u8* q, size_t key_size, int hash_id, size_t hash_len, const u8* hash, u8* signature)
+{
+	struct sRsaKey* key;
+	int ret;
+
+	if (modulus == NULL || priv_exp == NULL || hash == NULL || signature == NULL || key_size == 0 || key_size > CryptoRsa::kMaxKeySize)
+		return 1;
+
+	pthread_mutex_lock(&key_lock);
+	key = GetKey(modulus, priv_exp, p, q, key_size);
+	ret = key != NULL ? rsa_rsassa_pkcs1_v15_sign(&key->ctx, RSA_PRIVATE, hash_id, hash_len, hash, signature) : 1;
+	pthread_mutex_unlock(&key_lock);
+
+	return ret;
+}
+
+static struct sRsaPublicKey* GetPublicKey(const u8* modulus, size_t key_size)
+{
+	struct sRsaPublicKey* key;
+
+	for (key = public_key_list; key != NULL; key = key->next)
+	{
+		if (key->size == key_size && memcmp(key->modulus, modulus, key_size) == 0)
+			return key;
+	}
+
+	key = new struct sRsaPublicKey;
+	memcpy(key->modulus, modulus, key_size);
+	key->size = key_size;
+
+	// R^2 mod N is normally computed by the first exponentiation, do it here
+	// so verifying never writes to the context
+	rsa_init(&key->ctx, RSA_PKCS_V15, 0);
+	key->ctx.len = key_size;
+	if (mpi_read_binary(&key->ctx.N, modulus, key_size) != 0 || mpi_lset(&key->ctx.E, CryptoRsa::kPublicExponent) != 0
+		|| (key->ctx.N.p[0] & 1) == 0
+		|| mpi_lset(&key->ctx.RN, 1) != 0 || mpi_shift_l(&key->ctx.RN, key->ctx.N.n * 2 * sizeof(t_uint) * 8) != 0 || mpi_mod_mpi(&key->ctx.RN, &key->ctx.RN, &key->ctx.N) != 0)
+	{
+		rsa_free(&key->ctx);
+		delete key;
+		return NULL;
+	}
+
+	key->next = public_key_list;
+	public_key_list = key;
+
+	return key;
+}
+
+int CryptoRsa::Sign(const u8* modulus, const u8* priv_exp, size_t key_size, int hash_id, size_t hash_len, const u8* hash, u8* signature)
+{
+	return SignWithKey(modulus, priv_exp, NULL, NULL, key_size, hash_id, hash_len, hash, signature);
+}
+
+int CryptoRsa::SignCrt(const u8* modulus, const u8* priv_exp, const u8* p, const u8* q, size_t key_size, int hash_id, size_t hash_len, const u8* hash, u8* signature)
+{
+	return SignWithKey(modulus, priv_exp, p, q, key_size, hash_id, hash_len, hash, signature);
+}
+
+int CryptoRsa::Verify(const u8* modulus, size_t key_size, int hash_id, size_t hash_len, const u8* hash, const u8* signature)
+{
+	struct sRsaPublicKey* key;
+
+	if (modulus == NULL || hash == NULL || signature == NULL || key_size == 0 || key_size > CryptoRsa::kMaxKeySize)
+		return 1;
+
+	pthread_mutex_lock(&key_lock);
+	key = GetPublicKey(modulus, key_size);
+	pthread_mutex_unlock(&key_lock);
+
+	if (key == NULL)
+		return 1;
+
+	return rsa_rsassa_pkcs1_v15_verify(&key->ctx, RSA_PUBLIC, hash_id, hash_len, hash, signature);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include "types.h"
+
+// RSA key operations used by Crypto and EsSign
+class CryptoRsa
+{
+public:
+	static const int kMaxKeySize = 0x200;
+	static const int kPublicExponent = 65537;
+
+	// PKCS#1 v1.5 signature with the key (modulus, priv_exp) of key_size bytes.
+	// hash_id is one of the polarssl SIG_RSA_* ids. The key is parsed once and kept
+	// for the lifetime of the process; when its primes can be recovered the
+	// signature is computed with the CRT.
+	static int Sign(const u8* modulus, const u8* priv_exp, size_t key_size, int hash_id, size_t hash_len, const u8* hash, u8* signature);
+
+	// same as Sign, for callers that already know the primes of the key
+	static int SignCrt(const u8* modulus, const u8* priv_exp, const u8* p, const u8* q, size_t key_size, int hash_id, size_t hash_len, const u8* hash, u8* signature);
+
+	// check a PKCS#1 v1.5 signature against the public key (modulus, kPublicExponent).
+	// public keys are also kept for the lifetime of the process, and can be used by
+	// several threads at once. returns 0 if the signature is valid.
+	static int Verify(const u8* modulus, size_t key_size, int hash_id, size_t hash_len, const u8* hash, const u8* signature);
+};
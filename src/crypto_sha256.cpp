@@ -0,0 +1,522 @@
+#include <cstring>
+#include "crypto_sha256.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRYPTO_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*CompressFunc)(u32 state[8], const u8* blocks, size_t block_num);
+
+static const u32 kInitialState[8] =
+{
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const u32 kRoundConstants[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static inline u32 ror32(u32 x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline u32 load_be32(const u8* p)
+{
+	return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static inline void store_be32(u8* p, u32 x)
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+static void CompressPortable(u32 state[8], const u8* blocks, size_t block_num)
+{
+	u32 w[64];
+
+	for (; block_num > 0; block_num--, blocks += CryptoSha256::kBlockSize)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			w[i] = load_be32(blocks + i * 4);
+		}
+		for (int i = 16; i < 64; i++)
+		{
+			u32 s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			u32 s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		u32 a = state[0], b = state[1], c = state[2], d = state[3];
+		u32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 64; i++)
+		{
+			u32 t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + kRoundConstants[i] + w[i];
+			u32 t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+// pad the data after the last whole block of a message of the given size
+// with 0x80, zeros, and the bit length, returns the number of tail blocks
+static size_t PadTail(const u8* remaining, size_t size, u8 tail[CryptoSha256::kBlockSize * 2])
+{
+	size_t tail_size = size % CryptoSha256::kBlockSize;
+	size_t tail_block_num = (tail_size + 9 > (size_t)CryptoSha256::kBlockSize) ? 2 : 1;
+	u64 bit_size = (u64)size * 8;
+
+	memset(tail, 0, CryptoSha256::kBlockSize * 2);
+	memcpy(tail, remaining, tail_size);
+	tail[tail_size] = 0x80;
+	store_be32(tail + tail_block_num * CryptoSha256::kBlockSize - 8, (u32)(bit_size >> 32));
+	store_be32(tail + tail_block_num * CryptoSha256::kBlockSize - 4, (u32)bit_size);
+
+	return tail_block_num;
+}
+
+#ifdef CRYPTO_SHA256_X86
+// 4 rounds using the message words in m
+#define SHANI_ROUNDS(m, round) \
+	do { \
+		msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&kRoundConstants[round])); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+		msg = _mm_shuffle_epi32(msg, 0x0E); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+	} while (0)
+
+// expand the next 4 message words into w0, from the previous 16 in w0..w3
+#define SHANI_SCHEDULE(w0, w1, w2, w3) \
+	w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void CompressShaNi(u32 state[8], const u8* blocks, size_t block_num)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, w0, w1, w2, w3;
+
+	// shuffle the state from ABCD/EFGH into the ABEF/CDGH order the instructions use
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; block_num > 0; block_num--, blocks += CryptoSha256::kBlockSize)
+	{
+		abef = state0;
+		cdgh = state1;
+
+		w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 0x00)), byte_swap);
+		w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 0x10)), byte_swap);
+		w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 0x20)), byte_swap);
+		w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 0x30)), byte_swap);
+
+		SHANI_ROUNDS(w0, 0);
+		SHANI_ROUNDS(w1, 4);
+		SHANI_ROUNDS(w2, 8);
+		SHANI_ROUNDS(w3, 12);
+
+		for (int round = 16; round < 64; round += 16)
+		{
+			SHANI_SCHEDULE(w0, w1, w2, w3);
+			SHANI_ROUNDS(w0, round + 0);
+			SHANI_SCHEDULE(w1, w2, w3, w0);
+			SHANI_ROUNDS(w1, round + 4);
+			SHANI_SCHEDULE(w2, w3, w0, w1);
+			SHANI_ROUNDS(w2, round + 8);
+			SHANI_SCHEDULE(w3, w0, w1, w2);
+			SHANI_ROUNDS(w3, round + 12);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	// shuffle back to ABCD/EFGH
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#undef SHANI_ROUNDS
+#undef SHANI_SCHEDULE
+
+static bool HasShaNi()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	// SSSE3 & SSE4.1
+	if (!(ecx & BIT(9)) || !(ecx & BIT(19)))
+		return false;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	// SHA extensions
+	return (ebx & BIT(29)) != 0;
+}
+
+#define AVX2_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+// transpose 8 rows of 8 words, so row i holds word i of every lane
+__attribute__((target("avx2")))
+static inline void Transpose8x8(__m256i r[8])
+{
+	__m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	__m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	__m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// compress block_num blocks of 8 independent messages, one per 32-bit lane
+__attribute__((target("avx2")))
+static void CompressAvx2(__m256i state[8], const u8* const lanes[CryptoSha256::kLaneNum], size_t block_num)
+{
+	const __m256i byte_swap = _mm256_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m256i w[16];
+
+	for (size_t block = 0; block < block_num; block++)
+	{
+		size_t offset = block * CryptoSha256::kBlockSize;
+		for (int half = 0; half < 2; half++)
+		{
+			for (int lane = 0; lane < CryptoSha256::kLaneNum; lane++)
+			{
+				w[half * 8 + lane] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(lanes[lane] + offset + half * 0x20)), byte_swap);
+			}
+			Transpose8x8(w + half * 8);
+		}
+
+		__m256i a = state[0], b = state[1], c = state[2], d = state[3];
+		__m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 64; i++)
+		{
+			if (i >= 16)
+			{
+				__m256i w15 = w[(i + 1) & 15];
+				__m256i w2 = w[(i + 14) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w15, 7), AVX2_ROR(w15, 18)), _mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w2, 17), AVX2_ROR(w2, 19)), _mm256_srli_epi32(w2, 10));
+				w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i + 9) & 15], s1));
+			}
+
+			__m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(e, 6), AVX2_ROR(e, 11)), AVX2_ROR(e, 25));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+			__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(kRoundConstants[i]), w[i & 15])));
+			__m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(a, 2), AVX2_ROR(a, 13)), AVX2_ROR(a, 22));
+			__m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+			__m256i t2 = _mm256_add_epi32(sum0, maj);
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32(d, t1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32(t1, t2);
+		}
+
+		state[0] = _mm256_add_epi32(state[0], a); state[1] = _mm256_add_epi32(state[1], b);
+		state[2] = _mm256_add_epi32(state[2], c); state[3] = _mm256_add_epi32(state[3], d);
+		state[4] = _mm256_add_epi32(state[4], e); state[5] = _mm256_add_epi32(state[5], f);
+		state[6] = _mm256_add_epi32(state[6], g); state[7] = _mm256_add_epi32(state[7], h);
+	}
+}
+
+#undef AVX2_ROR
+
+__attribute__((target("avx2")))
+static void HashBlocksAvx2(const u8* in, size_t block_size, size_t block_num, u8* hashes)
+{
+	const u8* lanes[CryptoSha256::kLaneNum];
+	u8 tails[CryptoSha256::kLaneNum][CryptoSha256::kBlockSize * 2];
+	__m256i state[8];
+	u32 digest[8][CryptoSha256::kLaneNum];
+	size_t whole_block_num = block_size / CryptoSha256::kBlockSize;
+
+	for (size_t base = 0; base < block_num; base += CryptoSha256::kLaneNum)
+	{
+		// unused lanes repeat the first message, and their results are dropped
+		size_t lane_num = (block_num - base < (size_t)CryptoSha256::kLaneNum) ? block_num - base : CryptoSha256::kLaneNum;
+		for (int lane = 0; lane < CryptoSha256::kLaneNum; lane++)
+		{
+			lanes[lane] = in + block_size * (base + ((size_t)lane < lane_num ? lane : 0));
+		}
+
+		for (int i = 0; i < 8; i++)
+		{
+			state[i] = _mm256_set1_epi32(kInitialState[i]);
+		}
+		CompressAvx2(state, lanes, whole_block_num);
+
+		size_t tail_block_num = 0;
+		for (int lane = 0; lane < CryptoSha256::kLaneNum; lane++)
+		{
+			tail_block_num = PadTail(lanes[lane] + whole_block_num * CryptoSha256::kBlockSize, block_size, tails[lane]);
+			lanes[lane] = tails[lane];
+		}
+		CompressAvx2(state, lanes, tail_block_num);
+
+		for (int i = 0; i < 8; i++)
+		{
+			_mm256_storeu_si256((__m256i*)digest[i], state[i]);
+		}
+		for (size_t lane = 0; lane < lane_num; lane++)
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				store_be32(hashes + CryptoSha256::kHashLen * (base + lane) + i * 4, digest[i][lane]);
+			}
+		}
+	}
+}
+
+static bool HasAvx2()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	// OSXSAVE & AVX
+	if (!(ecx & BIT(27)) || !(ecx & BIT(28)))
+		return false;
+
+	// the os must save the ymm registers
+	u32 xcr0_lo, xcr0_hi;
+	__asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	if ((xcr0_lo & 6) != 6)
+		return false;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ebx & BIT(5)) != 0;
+}
+#endif
+
+static CompressFunc GetCompressFunc(CryptoSha256::Backend backend)
+{
+#ifdef CRYPTO_SHA256_X86
+	if (backend == CryptoSha256::BACKEND_SHANI)
+		return CompressShaNi;
+#endif
+	return CompressPortable;
+}
+
+static void HashWith(CompressFunc compress, const u8* in, size_t size, u8 hash[CryptoSha256::kHashLen])
+{
+	u32 state[8];
+	u8 tail[CryptoSha256::kBlockSize * 2];
+	size_t block_num = size / CryptoSha256::kBlockSize;
+
+	memcpy(state, kInitialState, sizeof(state));
+	compress(state, in, block_num);
+	compress(state, tail, PadTail(in + block_num * CryptoSha256::kBlockSize, size, tail));
+
+	for (int i = 0; i < 8; i++)
+	{
+		store_be32(hash + i * 4, state[i]);
+	}
+}
+
+static void HashBlocksWith(CryptoSha256::Backend backend, const u8* in, size_t block_size, size_t block_num, u8* hashes)
+{
+#ifdef CRYPTO_SHA256_X86
+	if (backend == CryptoSha256::BACKEND_AVX2)
+	{
+		HashBlocksAvx2(in, block_size, block_num, hashes);
+		return;
+	}
+#endif
+
+	CompressFunc compress = GetCompressFunc(backend);
+	for (size_t i = 0; i < block_num; i++)
+	{
+		HashWith(compress, in + block_size * i, block_size, hashes + CryptoSha256::kHashLen * i);
+	}
+}
+
+static CryptoSha256::Backend SelectBackend()
+{
+#ifdef CRYPTO_SHA256_X86
+	if (HasShaNi() && CryptoSha256::SelfTest(CryptoSha256::BACKEND_SHANI) == 0)
+		return CryptoSha256::BACKEND_SHANI;
+	if (HasAvx2() && CryptoSha256::SelfTest(CryptoSha256::BACKEND_AVX2) == 0)
+		return CryptoSha256::BACKEND_AVX2;
+#endif
+	return CryptoSha256::BACKEND_PORTABLE;
+}
+
+// selected once at startup, before any threads are created
+static const CryptoSha256::Backend kBackend = SelectBackend();
+static const CompressFunc kCompress = GetCompressFunc(kBackend);
+
+void CryptoSha256::Hash(const u8* in, size_t size, u8 hash[kHashLen])
+{
+	HashWith(kCompress, in, size, hash);
+}
+
+void CryptoSha256::HashBlocks(const u8* in, size_t block_size, size_t block_num, u8* hashes)
+{
+	HashBlocksWith(kBackend, in, block_size, block_num, hashes);
+}
+
+void CryptoSha256::Init(struct Crypto::sSha256Context& ctx)
+{
+	memcpy(ctx.state, kInitialState, sizeof(ctx.state));
+	ctx.size = 0;
+}
+
+void CryptoSha256::Update(struct Crypto::sSha256Context& ctx, const u8* in, size_t size)
+{
+	size_t used = ctx.size % kBlockSize;
+	ctx.size += size;
+
+	// complete a partially filled block first
+	if (used)
+	{
+		size_t copy_size = (size < kBlockSize - used) ? size : kBlockSize - used;
+		memcpy(ctx.block + used, in, copy_size);
+		in += copy_size;
+		size -= copy_size;
+		if (used + copy_size < (size_t)kBlockSize)
+			return;
+		kCompress(ctx.state, ctx.block, 1);
+	}
+
+	kCompress(ctx.state, in, size / kBlockSize);
+	memcpy(ctx.block, in + size - (size % kBlockSize), size % kBlockSize);
+}
+
+void CryptoSha256::Final(struct Crypto::sSha256Context& ctx, u8 hash[kHashLen])
+{
+	u8 tail[kBlockSize * 2];
+
+	kCompress(ctx.state, tail, PadTail(ctx.block, ctx.size, tail));
+	for (int i = 0; i < 8; i++)
+	{
+		store_be32(hash + i * 4, ctx.state[i]);
+	}
+}
+
+CryptoSha256::Backend CryptoSha256::backend()
+{
+	return kBackend;
+}
+
+const char* CryptoSha256::backend_name()
+{
+	switch (kBackend)
+	{
+	case (BACKEND_SHANI) :
+		return "sha-ni";
+	case (BACKEND_AVX2) :
+		return "avx2";
+	default:
+		return "portable";
+	}
+}
+
+int CryptoSha256::SelfTest(Backend backend)
+{
+	static const u8 kAbcHash[kHashLen] =
+	{
+		0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+		0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD
+	};
+	static const u8 kTwoBlockHash[kHashLen] =
+	{
+		0x24, 0x8D, 0x6A, 0x61, 0xD2, 0x06, 0x38, 0xB8, 0xE5, 0xC0, 0x26, 0x93, 0x0C, 0x3E, 0x60, 0x39,
+		0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF, 0x21, 0x67, 0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1
+	};
+	static const char kTwoBlockMessage[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+	CompressFunc compress = GetCompressFunc(backend);
+	u8 hash[kHashLen];
+	u8 reference[kHashLen];
+
+	HashWith(compress, (const u8*)"abc", 3, hash);
+	if (memcmp(hash, kAbcHash, kHashLen) != 0)
+		return 1;
+
+	HashWith(compress, (const u8*)kTwoBlockMessage, strlen(kTwoBlockMessage), hash);
+	if (memcmp(hash, kTwoBlockHash, kHashLen) != 0)
+		return 1;
+
+	// compare a multi block message against the portable implementation
+	u8 data[0x1000 + 0x2F];
+	for (size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = (u8)(i * 0x9D + (i >> 8));
+	}
+	HashWith(compress, data, sizeof(data), hash);
+	HashWith(CompressPortable, data, sizeof(data), reference);
+	if (memcmp(hash, reference, kHashLen) != 0)
+		return 1;
+
+	// batches of equally sized messages, with one and two padding blocks
+	static const size_t kBatchBlockSize[2] = { 0x1F7, 0x3C };
+	u8 hashes[kHashLen * 0x45];
+	for (int i = 0; i < 2; i++)
+	{
+		size_t block_num = sizeof(data) / kBatchBlockSize[i];
+		HashBlocksWith(backend, data, kBatchBlockSize[i], block_num, hashes);
+		for (size_t j = 0; j < block_num; j++)
+		{
+			HashWith(CompressPortable, data + kBatchBlockSize[i] * j, kBatchBlockSize[i], reference);
+			if (memcmp(hashes + kHashLen * j, reference, kHashLen) != 0)
+				return 1;
+		}
+	}
+
+	return 0;
+}
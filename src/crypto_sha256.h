@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include "types.h"
+#include "crypto.h"
+
+// SHA-256 implementations used by Crypto, selected at runtime for the host cpu
+class CryptoSha256
+{
+public:
+	static const int kHashLen = 0x20;
+	static const int kBlockSize = 0x40;
+
+	enum Backend
+	{
+		BACKEND_PORTABLE,
+		BACKEND_SHANI,
+		BACKEND_AVX2
+	};
+
+	// number of messages hashed side by side by the multi-buffer backend
+	static const int kLaneNum = 8;
+
+	static void Hash(const u8* in, size_t size, u8 hash[kHashLen]);
+	// hash block_num consecutive messages of block_size bytes each
+	static void HashBlocks(const u8* in, size_t block_size, size_t block_num, u8* hashes);
+
+	// incremental hashing, for data that isn't in memory all at once
+	static void Init(struct Crypto::sSha256Context& ctx);
+	static void Update(struct Crypto::sSha256Context& ctx, const u8* in, size_t size);
+	static void Final(struct Crypto::sSha256Context& ctx, u8 hash[kHashLen]);
+
+	// selected implementation
+	static Backend backend();
+	static const char* backend_name();
+
+	// known answer test of an implementation, returns 0 if it passes
+	static int SelfTest(Backend backend);
+};
@@ -0,0 +1,468 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+#include "types.h"
+#include "oschar.h"
+#include "MappedFile.h"
+#include "cia_header.h"
+#include "es_ticket.h"
+#include "es_tmd.h"
+#include "thread_pool.h"
+
+#include "ncch_header.h"
+#include "cxi_extended_header.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+#ifdef WIN32
+static inline char* FixMinGWPath(char* buf)
+{
+	if (*buf == '/')
+	{
+		buf[0] = buf[1];
+		buf[1] = ':';
+	}
+	return buf;
+}
+#else
+#define FixMinGWPath(_arg) (_arg)
+#endif
+
+struct sArgInfo
+{
+	const char *modulus_file;
+	int thread_num;
+
+	// files, or directories to search for files
+	std::vector<const char*> input;
+};
+
+class SignatureVerifier
+{
+public:
+	SignatureVerifier()
+	{
+
+	}
+
+	~SignatureVerifier()
+	{
+		for (size_t i = 0; i < files_.size(); i++)
+		{
+			free(files_[i]);
+		}
+	}
+
+	// returns 0 if every signature found was valid
+	int VerifyFiles(const struct sArgInfo& args)
+	{
+		safe_call(SetKeys(args));
+		safe_call(FindFiles(args));
+		safe_call(VerifyAll(args));
+		return PrintResults();
+	}
+
+private:
+	static const u32 kNcchMagicOffset = 0x100;
+	static const u32 kCiaContentAlign = 0x10;
+
+	struct sResult
+	{
+		// NULL if the file isn't a cia or ncch
+		const char* type;
+		int signature_num;
+		int failed_num;
+		// what failed to verify
+		std::string error;
+	};
+
+	// the tools sign everything with the same dummy key
+	u8 rsa_modulus_[Crypto::kRsa2048Size];
+
+	std::vector<oschar_t*> files_;
+	std::vector<struct sResult> results_;
+	double elapsed_;
+
+	ThreadPool pool_;
+
+	int SetKeys(const struct sArgInfo& args)
+	{
+		static const u8 DUMMY_RSA_MODULUS[Crypto::kRsa2048Size] =
+		{
+			0xAB, 0x7C, 0x3D, 0x15, 0xDF, 0xA1, 0xB0, 0x06, 0x7C, 0xC1, 0x47, 0xAA, 0x53, 0xD8, 0x86, 0x75, 0x42, 0x99, 0xE0, 0x18, 0x66, 0x03, 0x39, 0xD9, 0x79, 0xDA, 0x0A, 0x49, 0x2B, 0x64, 0x91, 0x45, 0x64, 0x90, 0x3D, 0x5F, 0x56, 0x0D, 0xD6, 0xD0, 0x37, 0xBF, 0x81, 0x1E, 0x92, 0xA8, 0xA5, 0x55, 0x09, 0xD9, 0xAE, 0x82, 0x43, 0x16, 0xD3, 0x68, 0x88, 0xBC, 0x4D, 0xCB, 0xC9, 0x2B, 0x0B, 0x47, 0xBD, 0xF8, 0xD9, 0x1A, 0x30, 0x80, 0x85, 0xA8, 0x30, 0x19, 0x77, 0x2E, 0xE9, 0x9F, 0x2D, 0xCA, 0xFC, 0x91, 0x82, 0xC8, 0x7F, 0xDA, 0xFE, 0xFA, 0xA9, 0x44, 0x87, 0x3E, 0xFF, 0x83, 0xA9, 0x4D, 0x80, 0xEC, 0xD5, 0xCB, 0x3E, 0xC8, 0xE8, 0xFF, 0x36, 0xF0, 0xF0, 0xD7, 0x84, 0x82, 0xE2, 0x09, 0x1A, 0x11, 0x76, 0xDF, 0x7A, 0x9B, 0x1C, 0x25, 0xB0, 0x6D, 0xE9, 0x8B, 0x54, 0x52, 0x55, 0x8F, 0x7F, 0x6F, 0xBF, 0xAF, 0xB8, 0xDD, 0xD4, 0xD4, 0xA1, 0x56, 0x8D, 0xF9, 0xF9, 0x98, 0x0E, 0x71, 0x93, 0xED, 0xB8, 0x99, 0xD3, 0xFA, 0x63, 0xF5, 0x6E, 0xAF, 0x9D, 0x49, 0xEA, 0xD7, 0xF7, 0xD9, 0x79, 0x7E, 0x51, 0x71, 0xE3, 0x4B, 0xEB, 0xA7, 0xCB, 0xD9, 0x5E, 0x89, 0x2B, 0x69, 0xBA, 0xEF, 0x98, 0x94, 0xA5, 0x74, 0x96, 0xAF, 0x4F, 0x9A, 0xDB, 0x93, 0x51, 0xE1, 0x99, 0x78, 0xCD, 0xEB, 0x15, 0xE1, 0x31, 0x32, 0xAC, 0x35, 0x9B, 0xD0, 0x4A, 0xDC, 0x87, 0x38, 0x5E, 0xA6, 0x42, 0x4A, 0xD2, 0x05, 0x51, 0x4F, 0x53, 0x9B, 0x8B, 0x3B, 0xE3, 0x03, 0xB9, 0x34, 0xFB, 0x56, 0xCC, 0x6E, 0x7B, 0x56, 0xEA, 0x38, 0x11, 0x44, 0xEE, 0xB0, 0x7B, 0x89, 0x35, 0x0B, 0x0F, 0x17, 0x2F, 0x5D, 0x4B, 0x30, 0x56, 0xF2, 0x06, 0x63, 0x4D, 0x85, 0x86, 0xB7, 0xFE, 0x85, 0xD4, 0xDF, 0xDE, 0xAF
+		};
+
+		memcpy(rsa_modulus_, DUMMY_RSA_MODULUS, Crypto::kRsa2048Size);
+
+		if (args.modulus_file != NULL)
+		{
+			FILE *fp;
+			size_t read_size;
+
+			if ((fp = fopen(args.modulus_file, "rb")) == NULL)
+			{
+				fprintf(stderr, "[ERROR] Failed to open modulus file: %s\n", args.modulus_file);
+				return 1;
+			}
+			read_size = fread(rsa_modulus_, 1, Crypto::kRsa2048Size, fp);
+			fclose(fp);
+
+			if (read_size != Crypto::kRsa2048Size) die("[ERROR] Modulus file is too small!");
+		}
+
+		return 0;
+	}
+
+	int FindFiles(const struct sArgInfo& args)
+	{
+		struct _osstat st;
+
+		files_.clear();
+		for (size_t i = 0; i < args.input.size(); i++)
+		{
+			oschar_t* path = os_CopyConvertCharStr(args.input[i]);
+
+			if (os_stat(path, &st) != 0)
+			{
+				free(path);
+				fprintf(stderr, "[ERROR] Failed to open: %s\n", args.input[i]);
+				return 1;
+			}
+
+			if (S_ISDIR(st.st_mode))
+			{
+				int ret = ScanDir(path);
+				free(path);
+				safe_call(ret);
+			}
+			else
+			{
+				files_.push_back(path);
+			}
+		}
+
+		return 0;
+	}
+
+	// add every regular file below path, in name order so the report is stable.
+	// links to directories aren't followed, so a link back up the tree can't make the walk loop forever
+	int ScanDir(const oschar_t* path)
+	{
+		_OSDIR *dp;
+		struct _osdirent *entry;
+		struct _osstat st;
+		std::vector<std::basic_string<oschar_t> > names;
+
+		if ((dp = os_opendir(path)) == NULL)
+		{
+			fprintf(stderr, "[ERROR] Failed to open directory: ");
+			os_fputs(path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+		while ((entry = os_readdir(dp)) != NULL)
+		{
+			const oschar_t* name = entry->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			{
+				continue;
+			}
+			names.push_back(name);
+		}
+		os_closedir(dp);
+
+		std::sort(names.begin(), names.end());
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			oschar_t* child = os_AppendToPath(path, names[i].c_str());
+
+			bool found = os_lstat(child, &st) == 0;
+#ifdef S_ISLNK
+			// links to files are still checked
+			if (found && S_ISLNK(st.st_mode))
+			{
+				found = os_stat(child, &st) == 0 && !S_ISDIR(st.st_mode);
+			}
+#endif
+
+			if (found && S_ISDIR(st.st_mode))
+			{
+				int ret = ScanDir(child);
+				free(child);
+				safe_call(ret);
+			}
+			else if (found && S_ISREG(st.st_mode))
+			{
+				files_.push_back(child);
+			}
+			else
+			{
+				free(child);
+			}
+		}
+
+		return 0;
+	}
+
+	int VerifyAll(const struct sArgInfo& args)
+	{
+		struct timeval start, end;
+
+		results_.clear();
+		results_.resize(files_.size());
+
+		// files are independent, and every public key is set up once and then shared by all threads
+		gettimeofday(&start, NULL);
+		pool_.SetThreadNum(args.thread_num);
+		safe_call(pool_.Run(VerifyFileTask, this, files_.size()));
+		gettimeofday(&end, NULL);
+
+		elapsed_ = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+		return 0;
+	}
+
+	int PrintResults()
+	{
+		int file_num = 0;
+		int failed_file_num = 0;
+		int signature_num = 0;
+
+		for (size_t i = 0; i < results_.size(); i++)
+		{
+			const struct sResult& result = results_[i];
+
+			// not something that is signed
+			if (result.type == NULL && result.error.empty())
+			{
+				continue;
+			}
+
+			file_num++;
+			signature_num += result.signature_num;
+
+			if (result.error.empty())
+			{
+				printf("[OK]   ");
+				os_fputs(files_[i], stdout);
+				printf(": %s, %d signatures\n", result.type, result.signature_num);
+			}
+			else
+			{
+				failed_file_num++;
+				printf("[FAIL] ");
+				os_fputs(files_[i], stdout);
+				printf(": %s, %d of %d signatures invalid (%s)\n", result.type ? result.type : "?", result.failed_num, result.signature_num, result.error.c_str());
+			}
+		}
+
+		printf("Verified %d signatures in %d files (%d failed, %d skipped) in %.3fs, %.0f signatures/s\n", signature_num, file_num, failed_file_num, (int)results_.size() - file_num, elapsed_, elapsed_ > 0 ? signature_num / elapsed_ : 0.0);
+
+		return failed_file_num > 0 ? 1 : 0;
+	}
+
+	static int VerifyFileTask(void* arg, size_t index)
+	{
+		return ((SignatureVerifier*)arg)->VerifyFile(index);
+	}
+
+	// the result of each file is kept rather than returned, so one bad file doesn't stop the others
+	int VerifyFile(size_t file_num)
+	{
+		struct sResult& result = results_[file_num];
+		CiaHeader cia_header;
+		MappedFile file;
+
+		result.type = NULL;
+		result.signature_num = 0;
+		result.failed_num = 0;
+
+		if (file.Open(files_[file_num]) != 0)
+		{
+			result.error = "failed to open file";
+			return 0;
+		}
+
+		if (file.size() >= cia_header.data_size() && le_word(*(const u32*)file.data()) == cia_header.data_size())
+		{
+			result.type = "CIA";
+			VerifyCia(result, file.data(), file.size());
+		}
+		else if (IsNcch(file.data(), file.size()))
+		{
+			result.type = "NCCH";
+			VerifyNcch(result, file.data(), file.size(), "");
+		}
+
+		return 0;
+	}
+
+	static bool IsNcch(const u8* data, u64 size)
+	{
+		NcchHeader ncch;
+
+		return size >= ncch.header_size() && memcmp(data + kNcchMagicOffset, "NCCH", 4) == 0;
+	}
+
+	static void AddCheck(struct sResult& result, const std::string& name, int rc)
+	{
+		result.signature_num++;
+		if (rc != 0)
+		{
+			result.failed_num++;
+			result.error += result.error.empty() ? name : ", " + name;
+		}
+	}
+
+	void VerifyCia(struct sResult& result, const u8* data, u64 size)
+	{
+		CiaHeader header;
+
+		if (header.SetHeader(data) != 0)
+		{
+			result.error = "bad header";
+			return;
+		}
+
+		if (header.ticket_offset() + (u64)header.ticket_size() > size || header.title_metadata_offset() + (u64)header.title_metadata_size() > size)
+		{
+			result.error = "file is truncated";
+			return;
+		}
+
+		AddCheck(result, "ticket", EsTicket::VerifyTicket(data + header.ticket_offset(), header.ticket_size(), rsa_modulus_));
+		AddCheck(result, "tmd", EsTmd::VerifyTitleMetadata(data + header.title_metadata_offset(), header.title_metadata_size(), rsa_modulus_));
+
+		// unencrypted contents are ncchs stored back to back, and carry their own signatures
+		u64 offset = header.content_offset();
+		u64 end = std::min<u64>(offset + header.content_size(), size);
+		for (int i = 0; offset < end && IsNcch(data + offset, end - offset); i++)
+		{
+			NcchHeader ncch;
+			char name[32];
+
+			ncch.SetHeader(data + offset);
+			if (ncch.ncch_size() == 0)
+			{
+				break;
+			}
+
+			snprintf(name, sizeof(name), "content %d ", i);
+			VerifyNcch(result, data + offset, std::min<u64>(ncch.ncch_size(), end - offset), name);
+			offset += align(ncch.ncch_size(), kCiaContentAlign);
+		}
+	}
+
+	void VerifyNcch(struct sResult& result, const u8* data, u64 size, const std::string& prefix)
+	{
+		NcchHeader ncch;
+		const u8* header_modulus = rsa_modulus_;
+		CxiExtendedHeader exheader;
+
+		if (ncch.SetHeader(data) != 0)
+		{
+			AddCheck(result, prefix + "ncch header", 1);
+			return;
+		}
+
+		// a cxi header is signed with the key from its access descriptor, which has to be checked first.
+		// encrypted exheaders can't be read, so those headers are checked against the known key
+		if (!ncch.is_cfa() && ncch.exheader_size() != 0 && !ncch.is_encrypted())
+		{
+			if (ncch.accessdesc_offset() + (u64)exheader.accessdesc_size() > size)
+			{
+				AddCheck(result, prefix + "access descriptor", 1);
+			}
+			else
+			{
+				exheader.SetData(data + ncch.exheader_offset(), data + ncch.accessdesc_offset());
+				AddCheck(result, prefix + "access descriptor", exheader.VerifyAccessDescriptor(rsa_modulus_));
+				header_modulus = exheader.ncch_rsa_modulus();
+			}
+		}
+
+		AddCheck(result, prefix + "ncch header", ncch.VerifyHeader(header_modulus));
+	}
+};
+
+int usage(const char *prog_name)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"    %s input [input...] [options]\n\n"
+		"Inputs are CIA or NCCH files, or directories that are searched for them.\n\n"
+		"Options:\n"
+		"    --modulus=file     : Verify against this RSA-2048 modulus instead of the dummy key\n"
+		"    --threads=num      : Number of threads, 0 uses every cpu core (default)\n"
+		, prog_name);
+	return 1;
+}
+
+int ParseArgs(struct sArgInfo& info, int argc, char **argv)
+{
+	info.modulus_file = NULL;
+	info.thread_num = 0;
+	info.input.clear();
+
+	char *arg, *value;
+
+	for (int i = 1; i < argc; i++)
+	{
+		arg = argv[i];
+		if (strncmp(arg, "--", 2) != 0)
+		{
+			info.input.push_back(FixMinGWPath(arg));
+			continue;
+		}
+
+		// skip over "--" to get name of argument
+		arg += 2;
+
+		// get argument value
+		value = strchr(arg, '=');
+
+		// check there is actually an argument value
+		if (value == NULL || value[1] == '\0')
+		{
+			return usage(argv[0]);
+		}
+
+		// skip over "=", overwriting it to null byte
+		*value++ = '\0';
+
+		if (strcmp(arg, "modulus") == 0)
+		{
+			info.modulus_file = FixMinGWPath(value);
+		}
+		else if (strcmp(arg, "threads") == 0)
+		{
+			info.thread_num = strtol(value, NULL, 0);
+		}
+		else
+		{
+			fprintf(stderr, "[ERROR] Unknown argument: %s\n", arg);
+			return usage(argv[0]);
+		}
+	}
+
+	// return if minimum requirements not met
+	if (info.input.empty())
+	{
+		return usage(argv[0]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	struct sArgInfo args;
+	SignatureVerifier verifier;
+	safe_call(ParseArgs(args, argc, argv));
+	return verifier.VerifyFiles(args);
+}
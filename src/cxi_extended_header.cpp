@@ -62,6 +62,14 @@ int CxiExtendedHeader::SetData(const u8* exheader, const u8* accessdesc)
 	return 0;
 }
 
+int CxiExtendedHeader::VerifyAccessDescriptor(const u8 accessdesc_rsa_modulus[Crypto::kRsa2048Size]) const
+{
+	u8 hash[Crypto::kSha256HashLen];
+
+	Crypto::Sha256((const u8*)&access_descriptor_.ncch_rsa_modulus, sizeof(struct sAccessDescriptor) - Crypto::kRsa2048Size, hash);
+	return Crypto::VerifyRsa2048Sha256(accessdesc_rsa_modulus, hash, access_descriptor_.signature);
+}
+
 // Set Process Info
 void CxiExtendedHeader::SetProcessName(const char* name)
 {
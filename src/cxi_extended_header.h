@@ -165,6 +165,10 @@ public:
 
 	// for parsing exheader
 	int SetData(const u8* exheader, const u8* accessdesc);
+	// check the access descriptor signature, returns 0 if it is valid
+	int VerifyAccessDescriptor(const u8 accessdesc_rsa_modulus[Crypto::kRsa2048Size]) const;
+	// key the ncch header is signed with
+	inline const u8* ncch_rsa_modulus() const { return access_descriptor_.ncch_rsa_modulus; }
 
 	// Set Process Info
 	void SetProcessName(const char* name);
@@ -1,19 +1,23 @@
 #include <cstring>
+#include <ctime>
 #include <algorithm>
 
 #include "crypto.h"
 #include "YamlReader.h"
 
 #include "ByteBuffer.h"
+#include "MappedFile.h"
 
 #include "ncch_header.h"
 #include "cxi_extended_header.h"
 #include "exefs_code.h"
+#include "blz.h"
 #include "ctr_app_icon.h"
 #include "smdh.h"
 #include "exefs.h"
 #include "ivfc.h"
 #include "romfs.h"
+#include "romfs_manifest.h"
 
 #define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
 #define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
@@ -46,6 +50,10 @@ struct sArgInfo
 	const char* short_title;
 	const char* long_title;
 	const char* author_name;
+	const char* thread_num;
+	const char* romfs_manifest;
+	bool is_romfs_deduplicated;
+	bool is_code_compressed;
 };
 
 class NcchBuilder
@@ -92,6 +100,7 @@ public:
 		exefs_hashed_data_size_ = 0;
 		romfs_hashed_data_size_ = 0;
 		romfs_full_size_ = 0;
+		build_time_ = 0;
 
 		memset(extended_header_hash_, 0, Crypto::kSha256HashLen);
 		memset(logo_hash_, 0, Crypto::kSha256HashLen);
@@ -107,6 +116,7 @@ public:
 	int BuildNcch(const struct sArgInfo& args)
 	{
 		args_ = args;
+		build_time_ = time(NULL);
 
 		SetDefaults();
 
@@ -188,7 +198,9 @@ private:
 	ByteBuffer logo_;
 	u8 logo_hash_[Crypto::kSha256HashLen];
 	
+	MappedFile elf_;
 	ExefsCode exefs_code_;
+	Blz compressed_code_;
 	ByteBuffer exefs_banner_;
 	ByteBuffer exefs_icon_;
 	Exefs exefs_;
@@ -201,6 +213,11 @@ private:
 	u32 romfs_hashed_data_size_;
 	u8 romfs_hash_[Crypto::kSha256HashLen];
 
+	// the romfs of the previous build, and the one being built
+	RomfsManifest prev_romfs_manifest_;
+	RomfsManifest romfs_manifest_;
+	u64 build_time_;
+
 
 	void SetDefaults()
 	{
@@ -1171,14 +1188,24 @@ private:
 
 	int MakeExefsCode()
 	{
-		ByteBuffer elf;
-
-		if (elf.OpenFile(args_.elf_file) != 0)
+		if (elf_.Open(args_.elf_file) != 0)
 		{
 			die("[ERROR] Cannot open ELF file!");
 		}
 
-		safe_call(exefs_code_.CreateCodeBlob(elf.data(), true));
+		// the code segments are used from the mapped elf, until the exefs is written
+		safe_call(exefs_code_.ParseCode(elf_.data(), true));
+
+		if (args_.is_code_compressed)
+		{
+			// the compressor needs the code in one piece
+			safe_call(exefs_code_.CreateCodeBlob());
+			compressed_code_.SetThreadNum(args_.thread_num ? strtol(args_.thread_num, NULL, 0) : 0);
+			safe_call(compressed_code_.Compress(exefs_code_.code_blob(), exefs_code_.code_size()));
+
+			// the exheader flag tells the loader to decompress the code
+			config_.is_compressed_code = compressed_code_.is_compressed();
+		}
 
 		return 0;
 	}
@@ -1276,9 +1303,15 @@ private:
 		safe_call(MakeExefsIcon());
 		safe_call(MakeNcchLogo());
 
-		if (exefs_code_.code_size() > 0)
+		if (config_.is_compressed_code)
+		{
+			safe_call(exefs_.SetExefsFile(".code", compressed_code_.data_blob(), compressed_code_.data_size()));
+		}
+		else if (exefs_code_.code_size() > 0)
 		{
-			safe_call(exefs_.SetExefsFile(".code", exefs_code_.code_blob(), exefs_code_.code_size()));
+			std::vector<struct Exefs::sFilePart> code;
+			exefs_code_.GetCodeParts(code);
+			safe_call(exefs_.SetExefsFile(".code", code));
 		}
 		else
 		{
@@ -1303,7 +1336,7 @@ private:
 		safe_call(exefs_.CreateExefs());
 
 		exefs_hashed_data_size_ = 0x200;
-		Crypto::Sha256(exefs_.data_blob(), exefs_hashed_data_size_, exefs_hash_);
+		Crypto::Sha256(exefs_.header_blob(), exefs_hashed_data_size_, exefs_hash_);
 
 		return 0;
 	}
@@ -1312,7 +1345,10 @@ private:
 	{
 		if (args_.romfs_dir)
 		{
-			safe_call(romfs_.CreateRomfs(args_.romfs_dir));
+			// the romfs is streamed, file data is only read when the romfs is written
+			romfs_.SetThreadNum(args_.thread_num ? strtol(args_.thread_num, NULL, 0) : 0);
+			romfs_.SetIsDeduplicated(args_.is_romfs_deduplicated);
+			safe_call(romfs_.CreateRomfs(args_.romfs_dir, true));
 			
 			// if romfs wasn't created
 			if (romfs_.data_size() == 0)
@@ -1320,13 +1356,13 @@ private:
 				die("[ERROR] Romfs wasn't created!");
 			}
 			
-			// setup ivfc hash tree
+			// setup ivfc layout, the hash tree is filled in as the romfs is written
 			// save total romfs blob size, and any other important related values
-			safe_call(ivfc_.CreateIvfcHashTree(romfs_.data_blob(), romfs_.data_size()));
+			ivfc_.SetThreadNum(args_.thread_num ? strtol(args_.thread_num, NULL, 0) : 0);
+			safe_call(ivfc_.CreateIvfcLayout(romfs_.data_size()));
 				
 			romfs_full_size_ = ivfc_.header_size() + align(romfs_.data_size(), Ivfc::kBlockSize) + ivfc_.level0_size() + ivfc_.level1_size();
 			romfs_hashed_data_size_ = align(ivfc_.used_header_size(), 0x200);
-			Crypto::Sha256(ivfc_.header_blob(), romfs_hashed_data_size_, romfs_hash_);
 		}
 
 		return 0;
@@ -1457,6 +1493,7 @@ private:
 			die("[ERROR] No Exefs was created!");
 		}
 
+		// the romfs hash isn't known until the romfs is written, it is set before signing
 		if (romfs_full_size_ > 0)
 		{
 			header_.SetRomfsData(romfs_full_size_, romfs_hashed_data_size_, romfs_hash_);
@@ -1467,21 +1504,247 @@ private:
 			header_.SetNcchType(NcchHeader::APPLICATION, NcchHeader::EXECUTABLE_WITHOUT_ROMFS);
 		}
 
+		header_.FinaliseNcchLayout();
+
+		return 0;
+	}
+
+	int SignHeader()
+	{
+		if (romfs_full_size_ > 0)
+		{
+			header_.SetRomfsData(romfs_full_size_, romfs_hashed_data_size_, romfs_hash_);
+		}
+
 		safe_call(header_.CreateHeader(cxi_rsa_key_.modulus, cxi_rsa_key_.priv_exponent));
 
 		return 0;
 	}
 
+	// the romfs is read, hashed and written in a single pass,
+	// only the ivfc hash levels are kept in memory
+	int WriteRomfs(FILE* fp)
+	{
+		ByteBuffer block;
+		u64 level2_size = align(romfs_.data_size(), Ivfc::kBlockSize);
+		u64 block_size = (u64)Ivfc::kBlockSize * Ivfc::kHashTaskBlockNum * ivfc_.thread_num();
+
+		if (block_size < Romfs::kStreamBlockSize)
+		{
+			block_size = Romfs::kStreamBlockSize;
+		}
+		safe_call(block.alloc_uninitialised(block_size));
+
+		// write level2 a.k.a. romfs
+		if (os_fseek64(fp, header_.romfs_offset() + ivfc_.header_size(), SEEK_SET) != 0)
+		{
+			die("[ERROR] Failed to write romfs.");
+		}
+		for (u64 pos = 0; pos < level2_size; pos += block_size)
+		{
+			if (level2_size - pos < block_size)
+			{
+				block_size = level2_size - pos;
+			}
+
+			// the final block is padded with zeros
+			u64 read_size = (romfs_.data_size() - pos < block_size) ? romfs_.data_size() - pos : block_size;
+			safe_call(romfs_.ReadData(block.data(), read_size));
+			memset(block.data() + read_size, 0, block_size - read_size);
+
+			safe_call(ivfc_.HashLevel2Blocks(block.data_const(), pos / Ivfc::kBlockSize, block_size / Ivfc::kBlockSize));
+			if (args_.romfs_manifest)
+			{
+				romfs_manifest_.HashLevel2(block.data_const(), pos, read_size);
+			}
+			if (fwrite(block.data_const(), 1, block_size, fp) != block_size)
+			{
+				die("[ERROR] Failed to write romfs.");
+			}
+		}
+
+		return WriteIvfcHashTree(fp);
+	}
+
+	// write the romfs files that changed since the previous build into its image,
+	// and rehash only the level2 blocks whose contents changed
+	int PatchRomfs(FILE* fp)
+	{
+		ByteBuffer block, level1;
+		u64 level2_offset = header_.romfs_offset() + ivfc_.header_size();
+		u64 level2_size = align(romfs_.data_size(), Ivfc::kBlockSize);
+		u64 block_size = (u64)Ivfc::kBlockSize * Ivfc::kHashTaskBlockNum * ivfc_.thread_num();
+		std::vector<bool> is_dirty(level2_size / Ivfc::kBlockSize, false);
+
+		if (block_size < Romfs::kStreamBlockSize)
+		{
+			block_size = Romfs::kStreamBlockSize;
+		}
+		safe_call(block.alloc_uninitialised(block_size));
+
+		// the hashes of the blocks that don't change are reused
+		safe_call(level1.alloc_uninitialised(ivfc_.level1_size()));
+		if (os_fseek64(fp, level2_offset + level2_size + ivfc_.level0_size(), SEEK_SET) != 0 || fread(level1.data(), 1, level1.size(), fp) != level1.size())
+		{
+			die("[ERROR] Failed to read romfs hashes.");
+		}
+		safe_call(ivfc_.SetLevel2Hashes(level1.data_const(), level1.size()));
+
+		for (size_t i = 0; i < romfs_manifest_.entry().size(); i++)
+		{
+			struct RomfsManifest::sEntry& entry = romfs_manifest_.entry()[i];
+			const struct RomfsManifest::sEntry& prev_entry = prev_romfs_manifest_.entry()[i];
+
+			if (entry.mtime == prev_entry.mtime && prev_entry.mtime != 0)
+			{
+				memcpy(entry.hash, prev_entry.hash, Crypto::kSha256HashLen);
+				continue;
+			}
+
+			u64 pos = romfs_manifest_.metadata_size() + entry.offset;
+			safe_call(PatchRomfsFile(fp, entry, level2_offset + pos, block));
+
+			// a file that was only touched doesn't change its blocks
+			if (memcmp(entry.hash, prev_entry.hash, Crypto::kSha256HashLen) != 0)
+			{
+				for (u64 j = pos / Ivfc::kBlockSize; j <= (pos + entry.size - 1) / Ivfc::kBlockSize; j++)
+				{
+					is_dirty[j] = true;
+				}
+			}
+		}
+
+		// rehash runs of changed blocks
+		for (u64 i = 0; i < is_dirty.size();)
+		{
+			u64 block_num = 0;
+			while (i + block_num < is_dirty.size() && is_dirty[i + block_num] && block_num < block_size / Ivfc::kBlockSize)
+			{
+				block_num++;
+			}
+
+			if (block_num == 0)
+			{
+				i++;
+				continue;
+			}
+
+			if (os_fseek64(fp, level2_offset + i * Ivfc::kBlockSize, SEEK_SET) != 0 || fread(block.data(), 1, block_num * Ivfc::kBlockSize, fp) != block_num * Ivfc::kBlockSize)
+			{
+				die("[ERROR] Failed to read romfs.");
+			}
+			safe_call(ivfc_.HashLevel2Blocks(block.data_const(), i, block_num));
+			i += block_num;
+		}
+
+		return WriteIvfcHashTree(fp);
+	}
+
+	// copy a romfs file to offset in the output, hashing it on the way
+	int PatchRomfsFile(FILE* fp, struct RomfsManifest::sEntry& entry, u64 offset, ByteBuffer& block)
+	{
+		struct Crypto::sSha256Context ctx;
+		FILE* in;
+
+		if ((in = os_fopen(entry.path, OS_MODE_READ)) == NULL)
+		{
+			fprintf(stderr, "[ERROR] Failed to open file for romfs: ");
+			os_fputs(entry.path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+
+		Crypto::Sha256Init(ctx);
+		if (os_fseek64(fp, offset, SEEK_SET) != 0)
+		{
+			fclose(in);
+			die("[ERROR] Failed to write romfs.");
+		}
+		for (u64 pos = 0; pos < entry.size; pos += block.size())
+		{
+			size_t size = (entry.size - pos < block.size()) ? entry.size - pos : block.size();
+			if (fread(block.data(), 1, size, in) != size)
+			{
+				fclose(in);
+				fprintf(stderr, "[ERROR] Failed to read file for romfs: ");
+				os_fputs(entry.path, stderr);
+				fputs("\n", stderr);
+				return 1;
+			}
+
+			Crypto::Sha256Update(ctx, block.data_const(), size);
+			if (fwrite(block.data_const(), 1, size, fp) != size)
+			{
+				fclose(in);
+				die("[ERROR] Failed to write romfs.");
+			}
+		}
+		Crypto::Sha256Final(ctx, entry.hash);
+		fclose(in);
+
+		return 0;
+	}
+
+	// finish the hash tree over level2, and write it after level2 and into the ivfc header
+	int WriteIvfcHashTree(FILE* fp)
+	{
+		u64 level2_size = align(romfs_.data_size(), Ivfc::kBlockSize);
+
+		safe_call(ivfc_.FinaliseIvfcHashTree());
+
+		// the hash levels follow level2
+		if (os_fseek64(fp, header_.romfs_offset() + ivfc_.header_size() + level2_size, SEEK_SET) != 0
+			|| fwrite(ivfc_.level0_blob(), 1, ivfc_.level0_size(), fp) != ivfc_.level0_size()
+			|| fwrite(ivfc_.level1_blob(), 1, ivfc_.level1_size(), fp) != ivfc_.level1_size())
+		{
+			die("[ERROR] Failed to write romfs hashes.");
+		}
+
+		if (os_fseek64(fp, header_.romfs_offset(), SEEK_SET) != 0 || fwrite(ivfc_.header_blob(), 1, ivfc_.header_size(), fp) != ivfc_.header_size())
+		{
+			die("[ERROR] Failed to write romfs hashes.");
+		}
+
+		Crypto::Sha256(ivfc_.header_blob(), romfs_hashed_data_size_, romfs_hash_);
+
+		return 0;
+	}
+
 	int WriteToFile()
 	{
 		// todo, ensure gaps between ncch sections are written with zeros and not just skipped over
 		FILE *fp;
+		int rc;
+		bool is_romfs_patched = false;
 
-		if ((fp = fopen(args_.out_file, "wb")) == NULL)
+		// the previous output is updated in place if its romfs has the same layout
+		if (args_.romfs_manifest && header_.romfs_offset())
+		{
+			romfs_manifest_.CreateManifest(args_.romfs_dir, header_.romfs_offset(), romfs_, build_time_);
+			is_romfs_patched = prev_romfs_manifest_.LoadManifest(args_.romfs_manifest) == 0 && prev_romfs_manifest_.IsSameLayout(romfs_manifest_) && prev_romfs_manifest_.IsOutputUnchanged(args_.out_file);
+		}
+
+		if ((fp = fopen(args_.out_file, is_romfs_patched ? "r+b" : "wb")) == NULL)
 		{
 			die("[ERROR] Failed to create output file.");
 		}
 
+		// write romfs, this has to be done first as the header can't be signed until the romfs is hashed
+		if (header_.romfs_offset())
+		{
+			if ((rc = is_romfs_patched ? PatchRomfs(fp) : WriteRomfs(fp)) != 0)
+			{
+				fclose(fp);
+				return rc;
+			}
+		}
+
+		if ((rc = SignHeader()) != 0)
+		{
+			fclose(fp);
+			return rc;
+		}
+
 		// write header
 		fseek(fp, 0, SEEK_SET);
 		fwrite(header_.header_blob(), 1, header_.header_size(), fp);
@@ -1512,32 +1775,32 @@ private:
 		if (header_.exefs_offset())
 		{
 			fseek(fp, header_.exefs_offset(), SEEK_SET);
-			fwrite(exefs_.data_blob(), 1, exefs_.data_size(), fp);
-		}
-		
-		// write romfs
-		if (header_.romfs_offset())
-		{
-			fseek(fp, header_.romfs_offset(), SEEK_SET);
-			fwrite(ivfc_.header_blob(), 1, ivfc_.header_size(), fp);
-
-			// write level2 a.k.a. romfs
-			for (u32 i = 0; i < romfs_.data_size() / Ivfc::kBlockSize; i++)
+			if (exefs_.WriteExefs(fp) != 0)
 			{
-				fwrite(romfs_.data_blob() + i*Ivfc::kBlockSize, 1, Ivfc::kBlockSize, fp);
+				fclose(fp);
+				die("[ERROR] Failed to write ExeFS.");
 			}
-			if (romfs_.data_size() % Ivfc::kBlockSize)
+		}
+
+		// the exefs can be smaller than in the previous build, don't leave its old end in the padding before the romfs
+		if (is_romfs_patched)
+		{
+			u8 padding[0x1000] = { 0 };
+			u64 exefs_end = header_.exefs_offset() + exefs_.data_size();
+			if (exefs_end < header_.romfs_offset())
 			{
-				u8 block[Ivfc::kBlockSize] = { 0 };
-				memcpy(block, romfs_.data_blob() + (romfs_.data_size() / Ivfc::kBlockSize)*Ivfc::kBlockSize, romfs_.data_size() % Ivfc::kBlockSize);
-				fwrite(block, 1, Ivfc::kBlockSize, fp);
+				fseek(fp, exefs_end, SEEK_SET);
+				fwrite(padding, 1, header_.romfs_offset() - exefs_end, fp);
 			}
-			
-			fwrite(ivfc_.level0_blob(), 1, ivfc_.level0_size(), fp);
-			fwrite(ivfc_.level1_blob(), 1, ivfc_.level1_size(), fp);
 		}
 
 		fclose(fp);
+
+		if (args_.romfs_manifest && header_.romfs_offset())
+		{
+			safe_call(romfs_manifest_.SaveManifest(args_.romfs_manifest, args_.out_file));
+		}
+
 		return 0;
 	}
 };
@@ -1557,6 +1820,11 @@ int usage(const char *prog_name)
 		"    --title=str        : App title\n"
 		"    --description=str  : App description\n"
 		"    --author=str       : App author\n"
+		"    --threads=num      : Threads used for reading and hashing (default: cpu cores)\n"
+		"    --romfs-dedup=on   : Store identical RomFS files once\n"
+		"    --compress-code=on : Compress the ExeFS .code with BLZ\n"
+		"    --romfs-manifest=file : Record the RomFS layout in file, and only rewrite\n"
+		"                         the files that changed when it matches the output\n"
 		, prog_name);
 	return 1;
 }
@@ -1637,6 +1905,30 @@ int ParseArgs(struct sArgInfo& info, int argc, char **argv)
 		{
 			info.author_name = value;
 		}
+		else if (strcmp(arg, "threads") == 0)
+		{
+			info.thread_num = value;
+		}
+		else if (strcmp(arg, "romfs-dedup") == 0)
+		{
+			if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+			{
+				return usage(argv[0]);
+			}
+			info.is_romfs_deduplicated = strcmp(value, "on") == 0;
+		}
+		else if (strcmp(arg, "compress-code") == 0)
+		{
+			if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+			{
+				return usage(argv[0]);
+			}
+			info.is_code_compressed = strcmp(value, "on") == 0;
+		}
+		else if (strcmp(arg, "romfs-manifest") == 0)
+		{
+			info.romfs_manifest = FixMinGWPath(value);
+		}
 		else
 		{
 			fprintf(stderr, "[ERROR] Unknown argument: %s\n", arg);
@@ -1,17 +1,15 @@
 #include <cstdio>
 #include <cstring>
 #include "polarssl/rsa.h"
+#include "crypto_rsa.h"
 #include "es_sign.h"
 
 int EsSign::RsaSign(EsSignType type, const u8* hash, const u8* modulus, const u8* priv_exp, u8* signature)
 {
-	int ret;
-	rsa_context rsa;
+	size_t key_size = 0;
 	int hash_id = 0;
 	int hash_len = 0;
 
-	rsa_init(&rsa, RSA_PKCS_V15, hash_id);
-
 	if (hash == NULL || modulus == NULL || priv_exp == NULL || signature == NULL) return 1;
 
 
@@ -20,7 +18,7 @@ int EsSign::RsaSign(EsSignType type, const u8* hash, const u8* modulus, const u8
 		case(ES_SIGN_RSA4096_SHA1) :
 		case(ES_SIGN_RSA4096_SHA256) :
 		{
-			rsa.len = Crypto::kRsa4096Size;
+			key_size = Crypto::kRsa4096Size;
 			hash_id = (type == ES_SIGN_RSA4096_SHA1) ? SIG_RSA_SHA1 : SIG_RSA_SHA256;
 			hash_len = (type == ES_SIGN_RSA4096_SHA1) ? Crypto::kSha1HashLen : Crypto::kSha256HashLen;
 			memset(signature, 0, sizeof(kRsa4096SignLen));
@@ -29,7 +27,7 @@ int EsSign::RsaSign(EsSignType type, const u8* hash, const u8* modulus, const u8
 		case(ES_SIGN_RSA2048_SHA1) :
 		case(ES_SIGN_RSA2048_SHA256) :
 		{
-			rsa.len = Crypto::kRsa2048Size;
+			key_size = Crypto::kRsa2048Size;
 			hash_id = (type == ES_SIGN_RSA2048_SHA1) ? SIG_RSA_SHA1 : SIG_RSA_SHA256;
 			hash_len = (type == ES_SIGN_RSA2048_SHA1) ? Crypto::kSha1HashLen : Crypto::kSha256HashLen;
 			memset(signature, 0, sizeof(kRsa2048SignLen));
@@ -39,30 +37,18 @@ int EsSign::RsaSign(EsSignType type, const u8* hash, const u8* modulus, const u8
 			return 1;
 	}
 
-	mpi_read_binary(&rsa.D, priv_exp, rsa.len);
-	mpi_read_binary(&rsa.N, modulus, rsa.len);
-
 	// set signature id
 	*((u32*)(signature)) = be_word(type);
-	ret = rsa_rsassa_pkcs1_v15_sign(&rsa, RSA_PRIVATE, hash_id, hash_len, hash, (signature + 4));
-	
-	rsa_free(&rsa);
-
-	return ret;
+	return CryptoRsa::Sign(modulus, priv_exp, key_size, hash_id, hash_len, hash, (signature + 4));
 }
 
 int EsSign::RsaVerify(const u8* hash, const u8* modulus, const u8* signature)
 {
-	static const u8 public_exponent[3] = { 0x01, 0x00, 0x01 };
-
-	int ret;
 	EsSignType type;
-	rsa_context rsa;
+	size_t key_size = 0;
 	int hash_id = 0;
 	int hash_len = 0;
 
-	rsa_init(&rsa, RSA_PKCS_V15, hash_id);
-
 	if (hash == NULL || modulus == NULL || signature == NULL) return 1;
 
 	// get signature type
@@ -73,7 +59,7 @@ int EsSign::RsaVerify(const u8* hash, const u8* modulus, const u8* signature)
 	case(ES_SIGN_RSA4096_SHA1) :
 	case(ES_SIGN_RSA4096_SHA256) :
 	{
-		rsa.len = Crypto::kRsa4096Size;
+		key_size = Crypto::kRsa4096Size;
 		hash_id = (type == ES_SIGN_RSA4096_SHA1) ? SIG_RSA_SHA1 : SIG_RSA_SHA256;
 		hash_len = (type == ES_SIGN_RSA4096_SHA1) ? Crypto::kSha1HashLen : Crypto::kSha256HashLen;
 		break;
@@ -81,7 +67,7 @@ int EsSign::RsaVerify(const u8* hash, const u8* modulus, const u8* signature)
 	case(ES_SIGN_RSA2048_SHA1) :
 	case(ES_SIGN_RSA2048_SHA256) :
 	{
-		rsa.len = Crypto::kRsa2048Size;
+		key_size = Crypto::kRsa2048Size;
 		hash_id = (type == ES_SIGN_RSA2048_SHA1) ? SIG_RSA_SHA1 : SIG_RSA_SHA256;
 		hash_len = (type == ES_SIGN_RSA2048_SHA1) ? Crypto::kSha1HashLen : Crypto::kSha256HashLen;
 		break;
@@ -90,12 +76,47 @@ int EsSign::RsaVerify(const u8* hash, const u8* modulus, const u8* signature)
 		return 1;
 	}
 
-	mpi_read_binary(&rsa.E, public_exponent, sizeof(public_exponent));
-	mpi_read_binary(&rsa.N, modulus, rsa.len);
+	return CryptoRsa::Verify(modulus, key_size, hash_id, hash_len, hash, signature + 4);
+}
 
-	ret = rsa_rsassa_pkcs1_v15_verify(&rsa, RSA_PRIVATE, hash_id, hash_len, hash, signature + 4);
+int EsSign::RsaVerifyBlob(const u8* data, u32 size, u32 signed_size, const u8* modulus)
+{
+	EsSignType type;
+	u32 sign_len;
+	u8 hash[Crypto::kSha256HashLen];
 
-	rsa_free(&rsa);
+	if (data == NULL || modulus == NULL || size < sizeof(u32)) return 1;
+
+	type = (EsSignType)be_word(*((u32*)(data)));
+
+	switch (type)
+	{
+	case(ES_SIGN_RSA4096_SHA1) :
+	case(ES_SIGN_RSA4096_SHA256) :
+		sign_len = kRsa4096SignLen;
+		break;
+	case(ES_SIGN_RSA2048_SHA1) :
+	case(ES_SIGN_RSA2048_SHA256) :
+		sign_len = kRsa2048SignLen;
+		break;
+	default:
+		return 1;
+	}
+
+	if (size < sign_len || size - sign_len < signed_size) return 1;
+	if (signed_size == 0)
+	{
+		signed_size = size - sign_len;
+	}
+
+	if (type == ES_SIGN_RSA4096_SHA1 || type == ES_SIGN_RSA2048_SHA1)
+	{
+		Crypto::Sha1(data + sign_len, signed_size, hash);
+	}
+	else
+	{
+		Crypto::Sha256(data + sign_len, signed_size, hash);
+	}
 
-	return ret;
+	return RsaVerify(hash, modulus, data);
 }
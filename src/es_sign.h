@@ -20,6 +20,9 @@ public:
 
 	static int RsaSign(EsSignType type, const u8* hash, const u8* modulus, const u8* priv_exp, u8* signature);
 	static int RsaVerify(const u8* hash, const u8* modulus, const u8* signature);
+	// verify a signed blob of size bytes, the signature covers signed_size bytes after the
+	// signature block, or the rest of the blob if signed_size is 0
+	static int RsaVerifyBlob(const u8* data, u32 size, u32 signed_size, const u8* modulus);
 
 private:
 };
\ No newline at end of file
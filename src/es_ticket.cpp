@@ -63,6 +63,12 @@ int EsTicket::CreateTicket(const char* signature_issuer, const u8 rsa_modulus[Cr
 	return 0;
 }
 
+int EsTicket::VerifyTicket(const u8* data, u32 size, const u8 rsa_modulus[Crypto::kRsa2048Size])
+{
+	// the signature covers the body and the content mask
+	return EsSign::RsaVerifyBlob(data, size, 0, rsa_modulus);
+}
+
 void EsTicket::SetTitleKey(const u8 title_key[Crypto::kAes128KeySize], const u8 common_key[Crypto::kAes128KeySize], u8 common_key_index)
 {
 	u8 enc_title_key[Crypto::kAes128KeySize];
@@ -132,6 +138,7 @@ int EsTicket::AddLimit(ESLimitCode id, u32 value)
 void EsTicket::SetContentMask(const std::vector<u16>& indexes)
 {
 	struct sContentMaskChunk entry;
+	ClearContentIndexControlEntry(entry);
 
 	for (size_t i = 0; i < indexes.size(); i++)
 	{
@@ -145,7 +152,7 @@ void EsTicket::SetContentMask(const std::vector<u16>& indexes)
 			entry.index_block = (indexes[i] >> 10);
 		}
 		
-		entry.num[(indexes[i] % BIT(10)) / sizeof(u8)] |= BIT(indexes[i] % sizeof(u8));
+		entry.num[(indexes[i] % BIT(10)) / 8] |= BIT(indexes[i] % 8);
 	}
 	content_mask_.push_back(entry);
 }
@@ -37,6 +37,9 @@ public:
 	inline const u8* data_blob() const { return ticket_.data_const(); }
 	inline u32 data_size() const { return ticket_.size(); }
 
+	// check the signature of a ticket blob, returns 0 if it is valid
+	static int VerifyTicket(const u8* data, u32 size, const u8 rsa_modulus[Crypto::kRsa2048Size]);
+
 	void SetTitleKey(const u8 title_key[Crypto::kAes128KeySize], const u8 common_key[Crypto::kAes128KeySize], u8 common_key_index);
 	void SetEncryptedTitleKey(const u8 title_key[Crypto::kAes128KeySize], u8 common_key_index);
 	void SetTicketId(u64 ticket_id);
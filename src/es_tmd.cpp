@@ -24,7 +24,7 @@ int EsTmd::CreateTitleMetadata(const char* signature_issuer, const u8 rsa_modulu
 
 	if (content_.size() == 0) die("[ERROR] No content was specified for Title Metadata!");
 
-	safe_call(title_metadata_.alloc(EsSign::kRsa2048SignLen + sizeof(struct sTitleMetadataBody) + sizeof(struct sInfoRecord)*kInfoRecordNum + sizeof(struct sContentInfo)*content_.size()));
+	safe_call(title_metadata_.alloc(GetDataSize(content_.size())));
 
 	// copy content info to buffer
 	struct sContentInfo* content_info = (struct sContentInfo*)(title_metadata_.data() + EsSign::kRsa2048SignLen + sizeof(struct sTitleMetadataBody) + sizeof(struct sInfoRecord)*kInfoRecordNum);
@@ -58,6 +58,17 @@ int EsTmd::CreateTitleMetadata(const char* signature_issuer, const u8 rsa_modulu
 	return 0;
 }
 
+u32 EsTmd::GetDataSize(u16 content_num)
+{
+	return EsSign::kRsa2048SignLen + sizeof(struct sTitleMetadataBody) + sizeof(struct sInfoRecord)*kInfoRecordNum + sizeof(struct sContentInfo)*content_num;
+}
+
+int EsTmd::VerifyTitleMetadata(const u8* data, u32 size, const u8 rsa_modulus[Crypto::kRsa2048Size])
+{
+	// only the body is signed, it holds the hash of the info records, which hash the content info
+	return EsSign::RsaVerifyBlob(data, size, sizeof(struct sTitleMetadataBody), rsa_modulus);
+}
+
 void EsTmd::SetSystemVersion(u64 system_version)
 {
 	body_.system_version = be_dword(system_version);
@@ -128,3 +139,17 @@ void EsTmd::AddContent(u32 id, u16 num, u16 flags, const u8* data, u64 size)
 
 	content_.push_back(content_info);
 }
+
+void EsTmd::AddContent(u32 id, u16 num, u16 flags, u64 size, const u8 hash[Crypto::kSha256HashLen])
+{
+	struct sContentInfo content_info;
+	memset((u8*)&content_info, 0, sizeof(struct sContentInfo));
+
+	content_info.id = be_word(id);
+	content_info.num = be_hword(num);
+	content_info.flags = be_hword(flags);
+	content_info.size = be_dword(align(size, kContentSizeAlign));
+	memcpy(content_info.hash, hash, Crypto::kSha256HashLen);
+
+	content_.push_back(content_info);
+}
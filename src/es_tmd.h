@@ -31,6 +31,11 @@ public:
 
 	inline const u8* data_blob() const { return title_metadata_.data_const(); }
 	inline u32 data_size() const { return title_metadata_.size(); }
+	// size of the title metadata once created, for laying out files before the content hashes are known
+	static u32 GetDataSize(u16 content_num);
+
+	// check the signature of a title metadata blob, returns 0 if it is valid
+	static int VerifyTitleMetadata(const u8* data, u32 size, const u8 rsa_modulus[Crypto::kRsa2048Size]);
 
 	void SetSystemVersion(u64 system_version);
 	void SetTitleId(u64 title_id);
@@ -42,6 +47,8 @@ public:
 	void SetTitleVersion(u16 version);
 	void SetBootContentIndex(u16 num);
 	void AddContent(u32 id, u16 num, u16 flags, const u8* data, u64 size);
+	// add content already hashed, the hash covers size aligned to 0x10 with zero padding
+	void AddContent(u32 id, u16 num, u16 flags, u64 size, const u8 hash[Crypto::kSha256HashLen]);
 
 private:
 	static const int kSignatureIssuerLen = 0x40;
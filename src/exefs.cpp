@@ -6,9 +6,22 @@
 #define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
 #define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
 
+#ifndef _WIN32
+#include <climits>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+#endif
+
+// source of the padding after each file, which is written instead of being stored
+static const u8 kZeroBlock[0x1000] = { 0 };
+
 Exefs::Exefs() :
 	block_size_(kDefaultBlockSize),
-	file_(0)
+	file_(0),
+	data_size_(0)
 {
 
 }
@@ -21,17 +34,10 @@ int Exefs::CreateExefs()
 {
 	struct sExefsHeader* header;
 	u32 offset;
-	u32 size;
 
-	size = sizeof(struct sExefsHeader);
-	for (u32 i = 0; i < file_.size(); i++)
-	{
-		size += align(file_[i].size, block_size_);
-	}
+	safe_call(header_.alloc(sizeof(struct sExefsHeader)));
 
-	safe_call(data_.alloc(size));
-
-	header = (struct sExefsHeader*)data_.data();
+	header = (struct sExefsHeader*)header_.data();
 	offset = 0;
 
 	for (u32 i = 0; i < file_.size(); i++)
@@ -42,32 +48,143 @@ int Exefs::CreateExefs()
 		header->files[i].size = le_word(file_[i].size);
 		memcpy(header->fileHashes[7 - i], file_[i].hash, Crypto::kSha256HashLen);
 
-		// copy file to exefs
-		memcpy(data_.data() + sizeof(struct sExefsHeader) + offset, file_[i].data, file_[i].size);
-
 		// update offset
 		offset += align(file_[i].size, block_size_);
 	}
 
+	data_size_ = sizeof(struct sExefsHeader) + offset;
+
 	return 0;
 }
 
 int Exefs::SetExefsFile(const char* name, const u8* data, u32 size)
+{
+	std::vector<struct sFilePart> part(1);
+
+	part[0].data = data;
+	part[0].size = size;
+	part[0].padding = 0;
+
+	return SetExefsFile(name, part);
+}
+
+int Exefs::SetExefsFile(const char* name, const std::vector<struct sFilePart>& part)
 {
 	if (file_.size() >= kMaxExefsFileNum) die("[ERROR] Too many files for Exefs.");
 
 	// copy details
 	struct sFile file;
+	struct Crypto::sSha256Context ctx;
 
 	file.name = name;
-	file.data = data;
-	file.size = size;
+	file.part = part;
+	file.size = 0;
 
-	// hash file
-	Crypto::Sha256(file.data, file.size, file.hash);
+	// hash file, straight from where its parts are
+	Crypto::Sha256Init(ctx);
+	for (size_t i = 0; i < part.size(); i++)
+	{
+		Crypto::Sha256Update(ctx, part[i].data, part[i].size);
+		for (u32 padding = part[i].padding; padding > 0; )
+		{
+			u32 size = (padding < sizeof(kZeroBlock)) ? padding : sizeof(kZeroBlock);
+			Crypto::Sha256Update(ctx, kZeroBlock, size);
+			padding -= size;
+		}
+		file.size += part[i].size + part[i].padding;
+	}
+	Crypto::Sha256Final(ctx, file.hash);
 	
 	// add file to
 	file_.push_back(file);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+int Exefs::WriteExefs(FILE* fp) const
+{
+	// the header, then the parts of each file and the padding to the next block, as data and size pairs
+	std::vector<struct sFilePart> chunk;
+	struct sFilePart header = { header_.data_const(), (u32)header_.size(), 0 };
+	chunk.push_back(header);
+	for (size_t i = 0; i < file_.size(); i++)
+	{
+		for (size_t j = 0; j <= file_[i].part.size(); j++)
+		{
+			struct sFilePart data = { NULL, 0, 0 };
+			u32 padding;
+			if (j < file_[i].part.size())
+			{
+				data.data = file_[i].part[j].data;
+				data.size = file_[i].part[j].size;
+				padding = file_[i].part[j].padding;
+			}
+			else
+			{
+				padding = align(file_[i].size, block_size_) - file_[i].size;
+			}
+
+			if (data.size > 0)
+			{
+				chunk.push_back(data);
+			}
+			while (padding > 0)
+			{
+				struct sFilePart zero = { kZeroBlock, (padding < sizeof(kZeroBlock)) ? padding : (u32)sizeof(kZeroBlock), 0 };
+				chunk.push_back(zero);
+				padding -= zero.size;
+			}
+		}
+	}
+
+	size_t written_num = 0;
+#ifndef _WIN32
+	if (fflush(fp) == 0)
+	{
+		std::vector<struct iovec> iov(chunk.size());
+		for (size_t i = 0; i < chunk.size(); i++)
+		{
+			iov[i].iov_base = (void*)chunk[i].data;
+			iov[i].iov_len = chunk[i].size;
+		}
+
+		// writev can stop part way through a buffer
+		int fd = fileno(fp);
+		while (written_num < iov.size())
+		{
+			ssize_t written = writev(fd, &iov[written_num], (iov.size() - written_num < IOV_MAX) ? iov.size() - written_num : IOV_MAX);
+			if (written <= 0)
+				break;
+
+			for (; written_num < iov.size() && (size_t)written >= iov[written_num].iov_len; written_num++)
+			{
+				written -= iov[written_num].iov_len;
+			}
+			if (written > 0)
+			{
+				iov[written_num].iov_base = (u8*)iov[written_num].iov_base + written;
+				iov[written_num].iov_len -= written;
+				chunk[written_num].data += written;
+				chunk[written_num].size -= written;
+			}
+		}
+
+		// keep the stream position in sync with what was written behind its back
+		if (fseeko(fp, lseek(fd, 0, SEEK_CUR), SEEK_SET) != 0)
+		{
+			return 1;
+		}
+	}
+#endif
+
+	// whatever couldn't be written at once goes through the stream
+	for (size_t i = written_num; i < chunk.size(); i++)
+	{
+		if (fwrite(chunk[i].data, 1, chunk[i].size, fp) != chunk[i].size)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdio>
 #include <vector>
 #include "types.h"
 #include "ByteBuffer.h"
@@ -7,18 +8,31 @@
 class Exefs
 {
 public:
+	// part of an exefs file, size bytes of data followed by padding zero bytes
+	struct sFilePart
+	{
+		const u8* data;
+		u32 size;
+		u32 padding;
+	};
+
 	Exefs();
 	~Exefs();
 
-	// trigger internal exefs creation
+	// create the exefs header, the files are only read when the exefs is written
 	int CreateExefs();
 
-	// add files to Exefs
+	// add files to Exefs, their data isn't copied so it has to stay valid until the exefs is written
 	int SetExefsFile(const char* name, const u8* data, u32 size);
-	
+	int SetExefsFile(const char* name, const std::vector<struct sFilePart>& part);
+
+	// write the header and files to the current position of fp, gathered into one write where the system allows it
+	int WriteExefs(FILE* fp) const;
+
 	// data extraction
-	inline const u8* data_blob() const { return data_.data_const(); }
-	inline u32 data_size() const { return data_.size(); }
+	inline const u8* header_blob() const { return header_.data_const(); }
+	inline u32 header_size() const { return header_.size(); }
+	inline u32 data_size() const { return data_size_; }
 private:
 	static const int kDefaultBlockSize = 0x200;
 	static const int kMaxExefsFileNameLen = 8;
@@ -26,7 +40,7 @@ private:
 
 	struct sFile
 	{
-		const u8 *data;
+		std::vector<struct sFilePart> part;
 		const char *name;
 		u32 size;
 		u8 hash[Crypto::kSha256HashLen];
@@ -46,5 +60,6 @@ private:
 
 	u32 block_size_;
 	std::vector<struct sFile> file_;
-	ByteBuffer data_;
+	ByteBuffer header_;
+	u32 data_size_;
 };
\ No newline at end of file
@@ -7,7 +7,9 @@
 #define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
 
 
-ExefsCode::ExefsCode()
+ExefsCode::ExefsCode() :
+	is_page_aligned_(true),
+	code_size_(0)
 {
 	InitCodeSegment(text_);
 	InitCodeSegment(rodata_);
@@ -17,40 +19,50 @@ ExefsCode::ExefsCode()
 
 ExefsCode::~ExefsCode()
 {
-	FreeCodeSegment(text_);
-	FreeCodeSegment(rodata_);
-	FreeCodeSegment(data_);
-	FreeCodeSegment(module_id_);
 }
 
-// internally generate code blob
+// find the code segments in an elf
 // code blobs are normally page aligned, except in builtin sysmodules
-int ExefsCode::CreateCodeBlob(const u8* elf, bool is_page_aligned)
+int ExefsCode::ParseCode(const u8* elf, bool is_page_aligned)
 {
-	u8* text, *rodata, *data;
-
 	safe_call(ParseElf(elf));
 
+	is_page_aligned_ = is_page_aligned;
 	if (is_page_aligned)
 	{
-		safe_call(code_blob_.alloc(PageToSize(text_.page_num + rodata_.page_num + data_.page_num)));
-
-		text = (code_blob_.data() + 0);
-		rodata = (code_blob_.data() + PageToSize(text_.page_num));
-		data = (code_blob_.data() + PageToSize(text_.page_num + rodata_.page_num));
+		code_size_ = PageToSize(text_.page_num + rodata_.page_num + data_.page_num);
 	}
 	else
 	{
-		safe_call(code_blob_.alloc(text_.file_size + rodata_.file_size + data_.file_size));
+		code_size_ = text_.file_size + rodata_.file_size + data_.file_size;
+	}
+
+	return 0;
+}
+
+void ExefsCode::GetCodeParts(std::vector<struct Exefs::sFilePart>& part) const
+{
+	part.clear();
+	AddCodePart(text_, part);
+	AddCodePart(rodata_, part);
+	AddCodePart(data_, part);
+}
+
+int ExefsCode::CreateCodeBlob()
+{
+	std::vector<struct Exefs::sFilePart> part;
+	u8* blob;
 
-		text = (code_blob_.data() + 0);
-		rodata = (code_blob_.data() + text_.file_size);
-		data = (code_blob_.data() + text_.file_size + rodata_.file_size);
+	// the padding is already zero
+	safe_call(code_blob_.alloc(code_size_));
+
+	GetCodeParts(part);
+	blob = code_blob_.data();
+	for (size_t i = 0; i < part.size(); i++)
+	{
+		memcpy(blob, part[i].data, part[i].size);
+		blob += part[i].size + part[i].padding;
 	}
-	
-	memcpy(text, text_.data, text_.file_size);
-	memcpy(rodata, rodata_.data, rodata_.file_size);
-	memcpy(data, data_.data, data_.file_size);
 
 	return 0;
 }
@@ -122,31 +134,27 @@ void ExefsCode::InitCodeSegment(struct sCodeSegment& segment)
 }
 
 
-void ExefsCode::FreeCodeSegment(struct sCodeSegment& segment)
-{
-	if (segment.data != NULL) 
-	{
-		free(segment.data);
-	}
-
-	InitCodeSegment(segment);
-}
-
 void ExefsCode::CreateCodeSegment(struct sCodeSegment& segment, const Elf32_Phdr& phdr, const u8* elf)
 {
-	FreeCodeSegment(segment);
-
 	segment.address = le_word(phdr.p_vaddr);
 	segment.file_size = le_word(phdr.p_filesz);
 	segment.memory_size = le_word(phdr.p_memsz);
 
 	segment.page_num = SizeToPage(segment.file_size);
-	segment.data = (u8*)malloc(segment.file_size);
-	if (segment.data == NULL) 
+	segment.data = elf + le_word(phdr.p_offset);
+}
+
+void ExefsCode::AddCodePart(const struct sCodeSegment& segment, std::vector<struct Exefs::sFilePart>& part) const
+{
+	struct Exefs::sFilePart code;
+
+	code.data = segment.data;
+	code.size = segment.file_size;
+	code.padding = is_page_aligned_ ? PageToSize(segment.page_num) - segment.file_size : 0;
+
+	// a missing segment has no pages
+	if (code.size > 0 || code.padding > 0)
 	{
-		InitCodeSegment(segment);
-		return; // error maybe?
+		part.push_back(code);
 	}
-
-	memcpy(segment.data, elf + le_word(phdr.p_offset), segment.file_size);
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 #pragma once
+#include <vector>
 #include "types.h"
 #include "elf.h"
 #include "ByteBuffer.h"
+#include "exefs.h"
 
 class ExefsCode
 {
@@ -9,13 +11,17 @@ public:
 	ExefsCode();
 	~ExefsCode();
 
-	// internally generate code blob
+	// find the code segments in an elf, they are used from the elf so it has to stay valid
 	// code blobs are normally page aligned, except in builtin sysmodules
-	int CreateCodeBlob(const u8* elf, bool is_page_aligned);
+	int ParseCode(const u8* elf, bool is_page_aligned);
+	// the code as parts of the elf, each segment is followed by the padding to its page size
+	void GetCodeParts(std::vector<struct Exefs::sFilePart>& part) const;
+	// copy the code into one blob, for when it has to be contiguous
+	int CreateCodeBlob();
 
 	// data relevant for CXI creation
 	inline const u8* code_blob() const { return code_blob_.data_const(); }
-	inline u32 code_size() const { return code_blob_.size(); }
+	inline u32 code_size() const { return code_size_; }
 	inline const u8* module_id_blob() const { return module_id_.data; }
 	inline u32 module_id_size() const { return module_id_.file_size; }
 
@@ -42,9 +48,11 @@ private:
 		u32 memory_size;
 		u32 file_size;
 		u32 page_num;
-		u8 *data;
+		const u8 *data;
 	};
 
+	bool is_page_aligned_;
+	u32 code_size_;
 	ByteBuffer code_blob_;
 
 	struct sCodeSegment text_;
@@ -55,8 +63,8 @@ private:
 	int ParseElf(const u8* elf);
 
 	void InitCodeSegment(struct sCodeSegment& segment);
-	void FreeCodeSegment(struct sCodeSegment& segment);
 	void CreateCodeSegment(struct sCodeSegment& segment, const Elf32_Phdr& phdr, const u8* elf);
+	void AddCodePart(const struct sCodeSegment& segment, std::vector<struct Exefs::sFilePart>& part) const;
 
 	inline u32 SizeToPage(u32 size) const {	return align(size, kCodePageSize) / kCodePageSize; }
 	inline u32 PageToSize(u32 page_num) const { return page_num * kCodePageSize; }
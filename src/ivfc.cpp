@@ -3,9 +3,30 @@
 
 #define IVFC_MAGIC "IVFC"
 
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
 #define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
 
-Ivfc::Ivfc()
+struct sHashBlocksTask
+{
+	const u8* data;
+	u64 block_num;
+	u8* hashes;
+};
+
+static int HashBlocksTask(void* arg, size_t index)
+{
+	const struct sHashBlocksTask* task = (const struct sHashBlocksTask*)arg;
+	u64 start = index * Ivfc::kHashTaskBlockNum;
+	u64 end = (start + Ivfc::kHashTaskBlockNum < task->block_num) ? start + Ivfc::kHashTaskBlockNum : task->block_num;
+
+	Crypto::Sha256Blocks(task->data + Ivfc::kBlockSize*start, Ivfc::kBlockSize, end - start, task->hashes + Crypto::kSha256HashLen*start);
+
+	return 0;
+}
+
+Ivfc::Ivfc() :
+	header_used_size_(0),
+	level2_block_num_(0)
 {
 }
 
@@ -14,6 +35,24 @@ Ivfc::~Ivfc()
 }
 
 int Ivfc::CreateIvfcHashTree(const u8* level2, u64 level2_size)
+{
+	safe_call(CreateIvfcLayout(level2_size));
+
+	// create level 1 hashes from level 2
+	safe_call(HashLevel2Blocks(level2, 0, level2_size / kBlockSize));
+	// if there was additional data after the last whole block
+	// copy the remaining data into a block, and hash that
+	if ((level2_size % kBlockSize) > 0)
+	{
+		u8 block[kBlockSize] = { 0 };
+		memcpy(block, level2 + ((level2_size / kBlockSize)*kBlockSize), (level2_size % kBlockSize));
+		safe_call(HashLevel2Blocks(block, level2_size / kBlockSize, 1));
+	}
+
+	return FinaliseIvfcHashTree();
+}
+
+int Ivfc::CreateIvfcLayout(u64 level2_size)
 {
 	struct sIvfcHeader hdr;
 	memset((u8*)&hdr, 0, sizeof(struct sIvfcHeader));
@@ -42,40 +81,88 @@ int Ivfc::CreateIvfcHashTree(const u8* level2, u64 level2_size)
 	
 	// save used header size
 	header_used_size_ = align(sizeof(struct sIvfcHeader), 0x10) + le_word(hdr.master_hash_size);
+	level2_block_num_ = align(level2_size, kBlockSize) / kBlockSize;
 
 	// allocate memory for each hash level & the header
 	safe_call(level_[1].alloc(align(le_dword(hdr.level[1].size), kBlockSize)));
 	safe_call(level_[0].alloc(align(le_dword(hdr.level[0].size), kBlockSize)));
 	safe_call(header_.alloc(align(align(sizeof(struct sIvfcHeader),0x10) + le_dword(hdr.master_hash_size), kBlockSize)));
 
-	// create level 1 hashes from level 2
-	for (size_t i = 0; i < (level2_size / kBlockSize); i++)
-	{
-		Crypto::Sha256(level2 + kBlockSize*i, kBlockSize, level_[1].data() + Crypto::kSha256HashLen*i);
-	}
-	// if there was additional data after the last whole block
-	// copy the remaining data into a block, and hash that
-	if ((level2_size % kBlockSize) > 0)
-	{
-		u8 block[kBlockSize] = { 0 };
-		memcpy(block, level2 + ((level2_size / kBlockSize)*kBlockSize), (level2_size % kBlockSize));
-		Crypto::Sha256(block, kBlockSize, level_[1].data() + Crypto::kSha256HashLen*(level2_size / kBlockSize));
-	}
+	// copy header into header buffer
+	memcpy(header_.data(), (u8*)&hdr, sizeof(struct sIvfcHeader));
+
+	return 0;
+}
+
+int Ivfc::HashLevel2Blocks(const u8* blocks, u64 block_index, u64 block_num)
+{
+	if (block_index + block_num > level2_block_num_) die("[ERROR] Level 2 block is outside of the IVFC layout.");
+
+	return HashBlocks(blocks, block_num, level_[1].data() + Crypto::kSha256HashLen*block_index);
+}
+
+int Ivfc::SetLevel2Hashes(const u8* hashes, u64 size)
+{
+	if (size != level_[1].size()) die("[ERROR] Level 1 size doesn't match the IVFC layout.");
+
+	memcpy(level_[1].data(), hashes, size);
 
+	return 0;
+}
+
+int Ivfc::FinaliseIvfcHashTree()
+{
 	// create level 0 hashes from level 1
-	for (size_t i = 0; i < (level_[1].size() / kBlockSize); i++)
-	{
-		Crypto::Sha256(level_[1].data() + kBlockSize*i, kBlockSize, level_[0].data() + Crypto::kSha256HashLen*i);
-	}
+	safe_call(HashBlocks(level_[1].data_const(), level_[1].size() / kBlockSize, level_[0].data()));
 
 	// create master hashes from level 0
-	for (size_t i = 0; i < (level_[0].size() / kBlockSize); i++)
+	safe_call(HashBlocks(level_[0].data_const(), level_[0].size() / kBlockSize, header_.data() + align(sizeof(struct sIvfcHeader), 0x10)));
+
+	return 0;
+}
+
+int Ivfc::GetImageGeometry(const u8* image, u64 image_size, struct sImageGeometry& geometry)
+{
+	const struct sIvfcHeader* hdr = (const struct sIvfcHeader*)image;
+
+	if (image_size < sizeof(struct sIvfcHeader) || memcmp(hdr->magic, IVFC_MAGIC, 4) != 0 || le_word(hdr->type) != kIvfcTypeRomfs)
+		return 1;
+
+	for (int i = 0; i < kLevelNum; i++)
 	{
-		Crypto::Sha256(level_[0].data() + kBlockSize*i, kBlockSize, header_.data() + align(sizeof(struct sIvfcHeader), 0x10) + Crypto::kSha256HashLen*i);
+		// a block has to hold at least one hash of the level below
+		if (le_word(hdr->level[i].block_size) < 5 || le_word(hdr->level[i].block_size) >= 32)
+			return 1;
+
+		geometry.level[i].size = le_dword(hdr->level[i].size);
+		geometry.level[i].block_size = 1 << le_word(hdr->level[i].block_size);
 	}
 
-	// copy header into header buffer
-	memcpy(header_.data(), (u8*)&hdr, sizeof(struct sIvfcHeader));
+	geometry.master_hash_offset = align(sizeof(struct sIvfcHeader), 0x10);
+	geometry.master_hash_size = le_word(hdr->master_hash_size);
+
+	// level2 follows the header and master hashes, then level0 and level1, each aligned to its block size
+	geometry.level[2].offset = align(geometry.master_hash_offset + geometry.master_hash_size, geometry.level[2].block_size);
+	geometry.level[0].offset = align(geometry.level[2].offset + geometry.level[2].size, geometry.level[0].block_size);
+	geometry.level[1].offset = align(geometry.level[0].offset + geometry.level[0].size, geometry.level[1].block_size);
+
+	if (geometry.level[2].offset > image_size || geometry.level[2].size > image_size - geometry.level[2].offset)
+		return 1;
 
 	return 0;
+}
+
+void Ivfc::SetThreadNum(int thread_num)
+{
+	pool_.SetThreadNum(thread_num);
+}
+
+int Ivfc::HashBlocks(const u8* data, u64 block_num, u8* hashes)
+{
+	struct sHashBlocksTask task;
+	task.data = data;
+	task.block_num = block_num;
+	task.hashes = hashes;
+
+	return pool_.Run(HashBlocksTask, &task, align(block_num, kHashTaskBlockNum) / kHashTaskBlockNum);
 }
\ No newline at end of file
@@ -3,17 +3,50 @@
 #include "types.h"
 #include "ByteBuffer.h"
 #include "crypto.h"
+#include "thread_pool.h"
 
 class Ivfc
 {
 public:
+	static const int kLevelNum = 3;
 	static const int kBlockSize = 0x1000;
+	// number of blocks hashed by each thread pool task
+	static const u32 kHashTaskBlockNum = 0x100;
 
 	Ivfc();
 	~Ivfc();
 
+	// create the hash tree for level2 data held in memory
 	int CreateIvfcHashTree(const u8* level2, u64 level2_size);
 
+	// create the hash tree incrementally, for level2 data that is streamed
+	// level2 blocks can be hashed in any order, the final block must be zero padded
+	int CreateIvfcLayout(u64 level2_size);
+	int HashLevel2Blocks(const u8* blocks, u64 block_index, u64 block_num);
+	int FinaliseIvfcHashTree();
+	// restore the level2 block hashes (level1) of an existing image, so only the blocks that changed need to be rehashed
+	int SetLevel2Hashes(const u8* hashes, u64 size);
+
+	// where the master hashes and each level are in an existing ivfc image, offsets are from the start of the image
+	struct sImageGeometry
+	{
+		u64 master_hash_offset;
+		u32 master_hash_size;
+		struct sLevelGeometry
+		{
+			u64 offset;
+			u64 size;
+			u32 block_size;
+		} level[kLevelNum];
+	};
+	// find the levels of an existing ivfc image of image_size bytes, returns non-zero if it isn't a romfs ivfc image.
+	// only level2 is checked to be inside the image, the hash levels may have been left off
+	static int GetImageGeometry(const u8* image, u64 image_size, struct sImageGeometry& geometry);
+
+	// number of threads used for hashing, 0 uses one thread per cpu core
+	void SetThreadNum(int thread_num);
+	inline int thread_num() const { return pool_.thread_num(); }
+
 	inline const u8* header_blob() const { return header_.data_const(); }
 	inline u32 header_size() const { return header_.size(); }
 	inline u32 used_header_size() const { return header_used_size_; }
@@ -22,7 +55,6 @@ public:
 	inline const u8* level1_blob() const { return level_[1].data_const(); }
 	inline u64 level1_size() const { return level_[1].size(); }
 private:
-	static const int kLevelNum = 3;
 	static const u32 kIvfcTypeRomfs = 0x10000;
 	static const u32 kIvfcTypeExtdata = 0x20000;
 
@@ -46,6 +78,12 @@ private:
 
 	ByteBuffer header_;
 	u32 header_used_size_;
+	u64 level2_block_num_;
 	ByteBuffer level_[kLevelNum-1];
+
+	ThreadPool pool_;
+
+	// hash whole blocks across the thread pool
+	int HashBlocks(const u8* data, u64 block_num, u8* hashes);
 };
 
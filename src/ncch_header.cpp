@@ -59,6 +59,14 @@ int NcchHeader::SetHeader(const u8 * header)
 	return 0;
 }
 
+int NcchHeader::VerifyHeader(const u8 modulus[Crypto::kRsa2048Size]) const
+{
+	u8 hash[Crypto::kSha256HashLen];
+
+	Crypto::Sha256((const u8*)header_.magic, sizeof(struct sNcchHeader) - 0x100, hash);
+	return Crypto::VerifyRsa2048Sha256(modulus, hash, header_.signature);
+}
+
 // Basic Data
 void NcchHeader::SetTitleId(u64 title_id)
 {
@@ -39,6 +39,8 @@ public:
 
 	// Set header for parsing ncch headers
 	int SetHeader(const u8* header);
+	// check the header signature, returns 0 if it is valid
+	int VerifyHeader(const u8 modulus[Crypto::kRsa2048Size]) const;
 
 	// Basic Data
 	void SetTitleId(u64 title_id);
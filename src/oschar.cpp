@@ -210,6 +210,54 @@ utf16char_t* strcopy_UTF8toUTF16(const char *src)
 
 	return out;
 }
+
+char* strcopy_UTF16toUTF8(const utf16char_t *src)
+{
+	std::vector<char> rstr;
+	for (; *src != 0; src++)
+	{
+		uint32_t code = *src;
+
+		// Decode surrogate pairs, unpaired surrogates are replaced
+		if (code >= 0xD800 && code < 0xDC00 && src[1] >= 0xDC00 && src[1] < 0xE000)
+		{
+			code = 0x10000 + ((code - 0xD800) << 10) + (src[1] - 0xDC00);
+			src++;
+		}
+		else if (code >= 0xD800 && code < 0xE000)
+			code = 0xFFFD;
+
+		// Encode Unicode codepoint as UTF-8
+		if (code < 0x80)
+			rstr.push_back(code);
+		else if (code < 0x800)
+		{
+			rstr.push_back(0xC0 | (code >> 6));
+			rstr.push_back(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			rstr.push_back(0xE0 | (code >> 12));
+			rstr.push_back(0x80 | ((code >> 6) & 0x3F));
+			rstr.push_back(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			rstr.push_back(0xF0 | (code >> 18));
+			rstr.push_back(0x80 | ((code >> 12) & 0x3F));
+			rstr.push_back(0x80 | ((code >> 6) & 0x3F));
+			rstr.push_back(0x80 | (code & 0x3F));
+		}
+	}
+
+	char *out = (char*)calloc(sizeof(char), rstr.size()+1);
+	for (size_t i = 0; i < rstr.size(); i++)
+	{
+		out[i] = rstr[i];
+	}
+
+	return out;
+}
 #endif
 
 oschar_t* os_AppendToPath(const oschar_t *src, const oschar_t *add)
@@ -29,7 +29,7 @@
 
 #define os_CopyStr (oschar_t*)strcopy_16to16
 #define os_CopyConvertCharStr (oschar_t*)strcopy_8to16
-//#define os_CopyConvertUTF16Str (oschar_t*)strcopy_16to16
+#define os_CopyConvertUTF16Str (oschar_t*)strcopy_16to16
 #define utf16_CopyStr (utf16char_t*)strcopy_16to16
 #define utf16_CopyConvertOsStr (utf16char_t*)strcopy_16to16
 
@@ -42,8 +42,11 @@
 
 #define _osstat _stat64
 #define os_stat _wstat64
+// stat doesn't report links on windows
+#define os_lstat _wstat64
 
 #define os_fopen _wfopen
+#define os_fseek64 _fseeki64
 #define OS_MODE_READ L"rb"
 #define OS_MODE_WRITE L"wb"
 #define OS_MODE_EDIT L"rb+"
@@ -55,7 +58,7 @@
 
 #define os_CopyStr (oschar_t*)strcopy_8to8
 #define os_CopyConvertCharStr (oschar_t*)strcopy_8to8
-//#define os_CopyConvertUTF16Str (oschar_t*)strcopy_UTF16toUTF8
+#define os_CopyConvertUTF16Str (oschar_t*)strcopy_UTF16toUTF8
 #define utf16_CopyStr (utf16char_t*)strcopy_16to16
 #define utf16_CopyConvertOsStr (utf16char_t*)strcopy_UTF8toUTF16
 
@@ -68,8 +71,10 @@
 
 #define _osstat stat
 #define os_stat stat
+#define os_lstat lstat
 
 #define os_fopen fopen
+#define os_fseek64 fseeko
 #define OS_MODE_READ "rb"
 #define OS_MODE_WRITE "wb"
 #define OS_MODE_EDIT "rb+"
@@ -1327,6 +1327,94 @@ static void mpi_montg_init( t_uint *mm, const mpi *N )
     *mm = ~x + 1;
 }
 
+#if defined(POLARSSL_HAVE_UDBL)
+/*
+ * Fixed width Montgomery multiplication for the RSA moduli sizes
+ * (1024-bit CRT primes, 2048 and 4096-bit moduli), with the product and
+ * reduction interleaved in one pass (FIOS) on double width limb products.
+ */
+#define MPI_MONT_FIXED
+#define MPI_MONT_MAX_LIMBS  ( 4096 / biL )
+
+#if defined(__GNUC__)
+#define MPI_MONT_INLINE static inline __attribute__((always_inline))
+#else
+#define MPI_MONT_INLINE static __inline
+#endif
+
+/*
+ * A = A * B * R^-1 mod N, A has n + 1 limbs and B has n limbs
+ */
+MPI_MONT_INLINE void mpi_montmul_fios( size_t n, t_uint *A, const t_uint *B,
+                                       const t_uint *N, t_uint mm )
+{
+    size_t i, j;
+    t_udbl r;
+    t_uint a, u, c0, c1, borrow, mask;
+    t_uint t[MPI_MONT_MAX_LIMBS + 1], d[MPI_MONT_MAX_LIMBS];
+
+    memset( t, 0, ( n + 1 ) * ciL );
+
+    for( i = 0; i < n; i++ )
+    {
+        /*
+         * t = (t + A[i] * B + u * N) / 2^biL, both products accumulated
+         * in the same pass with their own carries
+         */
+        a = A[i];
+        r = (t_udbl) a * B[0] + t[0];
+        u = (t_uint) r * mm;
+        c0 = (t_uint)( r >> biL );
+        r = (t_udbl) u * N[0] + (t_uint) r;
+        c1 = (t_uint)( r >> biL );
+
+        for( j = 1; j < n; j++ )
+        {
+            r = (t_udbl) a * B[j] + t[j] + c0;
+            c0 = (t_uint)( r >> biL );
+            r = (t_udbl) u * N[j] + (t_uint) r + c1;
+            c1 = (t_uint)( r >> biL );
+            t[j - 1] = (t_uint) r;
+        }
+
+        r = (t_udbl) t[n] + c0 + c1;
+        t[n - 1] = (t_uint) r;
+        t[n] = (t_uint)( r >> biL );
+    }
+
+    /*
+     * t < 2N, subtract N unless that borrows, without branching on the result
+     */
+    borrow = 0;
+    for( j = 0; j < n; j++ )
+    {
+        r = (t_udbl) t[j] - N[j] - borrow;
+        d[j] = (t_uint) r;
+        borrow = (t_uint)( r >> biL ) & 1;
+    }
+
+    mask = (t_uint) 0 - ( t[n] | ( borrow ^ 1 ) );
+    for( j = 0; j < n; j++ )
+        A[j] = ( d[j] & mask ) | ( t[j] & ~mask );
+    A[n] = 0;
+}
+
+static void mpi_montmul_1024( t_uint *A, const t_uint *B, const t_uint *N, t_uint mm )
+{
+    mpi_montmul_fios( 1024 / biL, A, B, N, mm );
+}
+
+static void mpi_montmul_2048( t_uint *A, const t_uint *B, const t_uint *N, t_uint mm )
+{
+    mpi_montmul_fios( 2048 / biL, A, B, N, mm );
+}
+
+static void mpi_montmul_4096( t_uint *A, const t_uint *B, const t_uint *N, t_uint mm )
+{
+    mpi_montmul_fios( 4096 / biL, A, B, N, mm );
+}
+#endif /* POLARSSL_HAVE_UDBL */
+
 /*
  * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36)
  */
@@ -1335,6 +1423,33 @@ static void mpi_montmul( mpi *A, const mpi *B, const mpi *N, t_uint mm, const mp
     size_t i, n, m;
     t_uint u0, u1, *d;
 
+#if defined(MPI_MONT_FIXED)
+    void (*fixed)( t_uint *, const t_uint *, const t_uint *, t_uint );
+
+    fixed = ( N->n == 1024 / biL ) ? mpi_montmul_1024 :
+            ( N->n == 2048 / biL ) ? mpi_montmul_2048 :
+            ( N->n == 4096 / biL ) ? mpi_montmul_4096 : NULL;
+
+    if( fixed != NULL )
+    {
+        t_uint b[MPI_MONT_MAX_LIMBS];
+
+        /*
+         * short operands (e.g. 1 for the final reduction) are zero extended
+         */
+        if( B->n < N->n )
+        {
+            memset( b, 0, N->n * ciL );
+            memcpy( b, B->p, B->n * ciL );
+            fixed( A->p, b, N->p, mm );
+        }
+        else
+            fixed( A->p, B->p, N->p, mm );
+
+        return;
+    }
+#endif
+
     memset( T->p, 0, T->n * ciL );
 
     d = T->p;
@@ -1406,7 +1521,7 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
 
     i = mpi_msb( E );
 
-    wsize = ( i > 671 ) ? 6 : ( i > 239 ) ? 5 :
+    wsize = ( i > 1791 ) ? 7 : ( i > 671 ) ? 6 : ( i > 239 ) ? 5 :
             ( i >  79 ) ? 4 : ( i >  23 ) ? 3 : 1;
 
     if( wsize > POLARSSL_MPI_WINDOW_SIZE )
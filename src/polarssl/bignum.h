@@ -67,15 +67,16 @@ typedef UINT64 uint64_t;
 
 #if !defined(POLARSSL_CONFIG_OPTIONS)
 /*
- * Maximum window size used for modular exponentiation. Default: 6
- * Minimum value: 1. Maximum value: 6.
+ * Maximum window size used for modular exponentiation. Default: 7
+ * Minimum value: 1. Maximum value: 7.
  *
  * Result is an array of ( 2 << POLARSSL_MPI_WINDOW_SIZE ) MPIs used
- * for the sliding window calculation. (So 64 by default)
+ * for the sliding window calculation. (So 256 by default)
+ * Windows of 7 bits are only used for exponents over 1791 bits (RSA-4096).
  *
  * Reduction in size, reduces speed.
  */
-#define POLARSSL_MPI_WINDOW_SIZE                           6        /**< Maximum windows size used. */
+#define POLARSSL_MPI_WINDOW_SIZE                           7        /**< Maximum windows size used. */
 
 /*
  * Maximum size of MPIs allowed in bits and bytes for user-MPIs.
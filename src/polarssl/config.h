@@ -258,7 +258,7 @@
  * Uncomment this macro to disable the use of CRT in RSA.
  *
  */
-#define POLARSSL_RSA_NO_CRT
+//#define POLARSSL_RSA_NO_CRT
 
 
 /**
@@ -982,7 +982,7 @@
 
 // MPI / BIGNUM options
 //
-#define POLARSSL_MPI_WINDOW_SIZE            6 /**< Maximum windows size used. */
+#define POLARSSL_MPI_WINDOW_SIZE            7 /**< Maximum windows size used. */
 #define POLARSSL_MPI_MAX_SIZE             512 /**< Maximum number of bytes for usable MPIs. */
 
 // CTR_DRBG options
@@ -273,9 +273,18 @@ int rsa_private( rsa_context *ctx,
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
     }
 
-#if defined(POLARSSL_RSA_NO_CRT)
+#if !defined(POLARSSL_RSA_NO_CRT)
+    /*
+     * keys loaded without their primes can only use D
+     */
+    if( mpi_cmp_int( &ctx->P, 0 ) == 0 || mpi_cmp_int( &ctx->Q, 0 ) == 0 )
+    {
+#endif
     MPI_CHK( mpi_exp_mod( &T, &T, &ctx->D, &ctx->N, &ctx->RN ) );
-#else
+#if !defined(POLARSSL_RSA_NO_CRT)
+    }
+    else
+    {
     /*
      * faster decryption using the CRT
      *
@@ -297,6 +306,7 @@ int rsa_private( rsa_context *ctx,
      */
     MPI_CHK( mpi_mul_mpi( &T1, &T, &ctx->Q ) );
     MPI_CHK( mpi_add_mpi( &T, &T2, &T1 ) );
+    }
 #endif
 
     olen = ctx->len;
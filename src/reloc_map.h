@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "types.h"
+
+// one bit per word of the image, packed into 64-bit words.
+// bits can be set from several threads at once
+class RelocMap
+{
+	std::vector<u64> words;
+	size_t bitCount;
+
+public:
+	RelocMap() : words(), bitCount(0) { }
+
+	void Assign(size_t count)
+	{
+		bitCount = count;
+		words.assign((count + 63) / 64, 0);
+	}
+
+	void Set(size_t i)
+	{
+		__sync_fetch_and_or(&words[i / 64], (u64)1 << (i % 64));
+	}
+
+	bool Test(size_t i) const
+	{
+		return (__atomic_load_n(&words[i / 64], __ATOMIC_RELAXED) >> (i % 64)) & 1;
+	}
+
+	// Number of bits from i, up to end, that are all set or all clear, found a word at a time
+	size_t RunLength(size_t i, size_t end, bool set) const
+	{
+		size_t start = i;
+		while (i < end)
+		{
+			// The run ends at the lowest bit that differs from it, bits shifted in past the word never end it early
+			u64 word = words[i / 64] >> (i % 64);
+			u64 differ = set ? ~word : word;
+			size_t left = 64 - i % 64;
+			size_t run = differ ? __builtin_ctzll(differ) : left;
+			if (run > left) run = left;
+
+			i += run;
+			if (run < left) break;
+		}
+		return (i < end ? i : end) - start;
+	}
+
+	size_t size() const { return bitCount; }
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "romfs.h"
 
 #define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
@@ -15,18 +16,6 @@ static u32 CalcHashTableLen(u32 entryCount)
 #undef D
 }
 
-static u32 CalcHash(u32 parent, const utf16char_t *str, u32 total)
-{
-	u32 len = utf16_strlen(str);
-	u32 hash = parent ^ 123456789;
-	for (u32 i = 0; i < len; i++)
-	{
-		hash = (u32)((hash >> 5) | (hash << 27));
-		hash ^= (u16)str[i];
-	}
-	return hash % total;
-}
-
 u32 CalcPathHash(u32 parent, const utf16char_t* path)
 {
 	u32 len = utf16_strlen(path);
@@ -39,8 +28,119 @@ u32 CalcPathHash(u32 parent, const utf16char_t* path)
 	return hash;
 }
 
+static u32 CalcHash(u32 parent, const utf16char_t *str, u32 total)
+{
+	return CalcPathHash(parent, str) % total;
+}
+
+struct sDedupFile
+{
+	const RomfsDirScanner::sFile* file;
+	size_t index; // order of the file in the data region
+	u8 hash[Crypto::kSha256HashLen];
+};
 
-Romfs::Romfs()
+static bool IsSizeLess(const struct sDedupFile& a, const struct sDedupFile& b)
+{
+	if (a.file->size != b.file->size)
+		return a.file->size < b.file->size;
+	return a.index < b.index;
+}
+
+// identical files end up next to each other, the one stored first in the data region leading
+static bool IsContentLess(const struct sDedupFile* a, const struct sDedupFile* b)
+{
+	if (a->file->size != b->file->size)
+		return a->file->size < b->file->size;
+	int cmp = memcmp(a->hash, b->hash, Crypto::kSha256HashLen);
+	if (cmp != 0)
+		return cmp < 0;
+	return a->index < b->index;
+}
+
+struct sReadTask
+{
+	const oschar_t* path;
+	u64 file_offset;
+	u8* out;
+	size_t size;
+};
+
+static int ReadFileTask(void* arg, size_t index)
+{
+	const struct sReadTask& task = (*(std::vector<struct sReadTask>*)arg)[index];
+	FILE* fp;
+	int ret;
+
+	if ((fp = os_fopen(task.path, OS_MODE_READ)) == NULL)
+	{
+		fprintf(stderr, "[ERROR] Failed to open file for romfs: ");
+		os_fputs(task.path, stderr);
+		fputs("\n", stderr);
+		return 1;
+	}
+
+	ret = os_fseek64(fp, task.file_offset, SEEK_SET);
+	if (ret != 0 || fread(task.out, 1, task.size, fp) != task.size)
+	{
+		fclose(fp);
+		fprintf(stderr, "[ERROR] Failed to read file for romfs: ");
+		os_fputs(task.path, stderr);
+		fputs("\n", stderr);
+		return 1;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static int HashFileTask(void* arg, size_t index)
+{
+	struct sDedupFile* dedup = (*(std::vector<struct sDedupFile*>*)arg)[index];
+	const RomfsDirScanner::sFile* file = dedup->file;
+	struct Crypto::sSha256Context ctx;
+	ByteBuffer block;
+	FILE* fp;
+
+	if (block.alloc_uninitialised(file->size < Romfs::kStreamBlockSize ? file->size : Romfs::kStreamBlockSize) != 0)
+		return 1;
+
+	if ((fp = os_fopen(file->path, OS_MODE_READ)) == NULL)
+	{
+		fprintf(stderr, "[ERROR] Failed to open file for romfs: ");
+		os_fputs(file->path, stderr);
+		fputs("\n", stderr);
+		return 1;
+	}
+
+	Crypto::Sha256Init(ctx);
+	for (u64 pos = 0; pos < file->size; pos += block.size())
+	{
+		size_t size = (file->size - pos < block.size()) ? (size_t)(file->size - pos) : block.size();
+		if (fread(block.data(), 1, size, fp) != size)
+		{
+			fclose(fp);
+			fprintf(stderr, "[ERROR] Failed to read file for romfs: ");
+			os_fputs(file->path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+		Crypto::Sha256Update(ctx, block.data_const(), size);
+	}
+	Crypto::Sha256Final(ctx, dedup->hash);
+	fclose(fp);
+
+	return 0;
+}
+
+
+Romfs::Romfs() :
+	is_deduplicated_(false),
+	data_size_(0),
+	is_streamed_(false),
+	payload_(0),
+	read_pos_(0),
+	read_payload_(0)
 {
 }
 
@@ -48,20 +148,34 @@ Romfs::~Romfs()
 {
 }
 
-int Romfs::CreateRomfs(const char* dir)
+int Romfs::CreateRomfs(const char* dir, bool is_streamed)
 {
+	is_streamed_ = is_streamed;
+
 	safe_call(scanner_.ScanDir(dir));
 
 	// return if there's nothing in the directory
 	if (GetDirNum(scanner_.root_dir()) == 0 && GetFileNum(scanner_.root_dir()) == 0)
 		return 0;
 
+	if (is_deduplicated_)
+	{
+		safe_call(FindDuplicates());
+	}
+
 	safe_call(CreateRomfsLayout());
 
 	// add files and dirs to romfs layout
 	AddDirToRomfs(scanner_.root_dir(), 0, kUnusedOffset);
 	safe_call(AddDirChildToRomfs(scanner_.root_dir(), 0, 0));
 
+	// read all file data now if it is held in memory
+	if (!is_streamed_)
+	{
+		safe_call(ReadPayloads(header_.data, 0, data_size_ - (header_.data - data_.data())));
+		read_payload_ = 0;
+	}
+
 	return 0;
 }
 
@@ -120,7 +234,8 @@ u64 Romfs::GetDataSize(const RomfsDirScanner::sDirectory& dir)
 	u64 size = 0;
 	for (size_t i = 0; i < dir.file.size(); i++)
 	{
-		size = align(size, 0x10) + dir.file[i].size;
+		// duplicates take no space, like empty files
+		size = align(size, 0x10) + (duplicate_.count(&dir.file[i]) ? 0 : dir.file[i].size);
 	}
 
 	for (size_t i = 0; i < dir.child.size(); i++)
@@ -153,10 +268,10 @@ int Romfs::CreateRomfsLayout()
 		, 0x10);
 
 	data_size = GetDataSize(scanner_.root_dir());
+	data_size_ = header_size + data_size;
 
-
-	// allocate memory
-	safe_call(data_.alloc(header_size + data_size));
+	// allocate memory, file data is only held in memory if the romfs isn't streamed
+	safe_call(data_.alloc(is_streamed_ ? header_size : header_size + data_size));
 
 	// set header
 	struct sRomfsHeader* hdr = (struct sRomfsHeader*)data_.data();
@@ -200,7 +315,7 @@ int Romfs::CreateRomfsLayout()
 	}
 
 	header_.data_offset = 0;
-	header_.data = data_.data() + align(offset, 0x10);
+	header_.data = is_streamed_ ? NULL : data_.data() + align(offset, 0x10);
 
 	// set initial state for the hash tables
 	for (u32 i = 0; i < header_.dir_hash_num; i++)
@@ -216,6 +331,65 @@ int Romfs::CreateRomfsLayout()
 	return 0;
 }
 
+// files in the order their data is placed by AddDirChildToRomfs()
+void Romfs::GetFileList(const RomfsDirScanner::sDirectory& dir, std::vector<const RomfsDirScanner::sFile*>& list)
+{
+	for (size_t i = 0; i < dir.file.size(); i++)
+	{
+		list.push_back(&dir.file[i]);
+	}
+
+	for (size_t i = 0; i < dir.child.size(); i++)
+	{
+		GetFileList(dir.child[i], list);
+	}
+}
+
+int Romfs::FindDuplicates()
+{
+	std::vector<const RomfsDirScanner::sFile*> list;
+	std::vector<struct sDedupFile> file;
+	std::vector<struct sDedupFile*> hashed;
+
+	GetFileList(scanner_.root_dir(), list);
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		if (list[i]->size == 0)
+			continue;
+
+		struct sDedupFile dedup;
+		dedup.file = list[i];
+		dedup.index = i;
+		file.push_back(dedup);
+	}
+
+	// only files that have the same size can be identical, so the rest are never read
+	std::sort(file.begin(), file.end(), IsSizeLess);
+	for (size_t i = 0; i < file.size(); i++)
+	{
+		if ((i > 0 && file[i - 1].file->size == file[i].file->size) || (i + 1 < file.size() && file[i + 1].file->size == file[i].file->size))
+		{
+			hashed.push_back(&file[i]);
+		}
+	}
+
+	safe_call(pool_.Run(HashFileTask, &hashed, hashed.size()));
+
+	std::sort(hashed.begin(), hashed.end(), IsContentLess);
+	for (size_t i = 1, first = 0; i < hashed.size(); i++)
+	{
+		if (hashed[i]->file->size != hashed[first]->file->size || memcmp(hashed[i]->hash, hashed[first]->hash, Crypto::kSha256HashLen) != 0)
+		{
+			first = i;
+			continue;
+		}
+
+		duplicate_[hashed[i]->file] = hashed[first]->file;
+	}
+
+	return 0;
+}
+
 void Romfs::AddDirToRomfs(const RomfsDirScanner::sDirectory& dir, u32 parent, u32 sibling)
 {
 	struct sRomfsDirEntry* entry = (struct sRomfsDirEntry*)(header_.dir_entry_table + header_.dir_entry_offset);
@@ -265,7 +439,7 @@ int Romfs::AddDirChildToRomfs(const RomfsDirScanner::sDirectory& dir, u32 parent
 			child.push_back(header_.dir_entry_offset);
 
 			/* If is the last child directory, no more siblings  */
-			sibling = (i == dir.file.size() - 1) ? kUnusedOffset : (header_.dir_entry_offset + sizeof(struct sRomfsDirEntry) + align(dir.child[i].namesize, 4));
+			sibling = (i == dir.child.size() - 1) ? kUnusedOffset : (header_.dir_entry_offset + sizeof(struct sRomfsDirEntry) + align(dir.child[i].namesize, 4));
 		
 			/* Create child directory entry */
 			AddDirToRomfs(dir.child[i], diroff, sibling);
@@ -301,27 +475,98 @@ int Romfs::AddFileToRomfs(const RomfsDirScanner::sFile& file, u32 parent, u32 si
 		name[i] = le_hword(file.name[i]);
 	}
 	
-	if (file.size)
+	// a duplicate points at the data of the identical file stored before it
+	std::map<const RomfsDirScanner::sFile*, const RomfsDirScanner::sFile*>::const_iterator duplicate = duplicate_.find(&file);
+	if (duplicate != duplicate_.end())
+	{
+		entry->data_offset = le_dword(stored_offset_[duplicate->second]);
+	}
+	else if (file.size)
 	{
-		FILE *fp = os_fopen(file.path, OS_MODE_READ);
-		if (!fp)
-		{
-			fprintf(stderr, "[ERROR] Failed to open file for romfs: ");
-			os_fputs(file.path, stderr);
-			fputs("\n", stderr);
-			return 1;
-		}
-
 		// align data pos to 0x10 bytes
 		header_.data_offset = align(header_.data_offset, 0x10);
 		entry->data_offset = le_dword(header_.data_offset);
+		if (is_deduplicated_)
+		{
+			stored_offset_[&file] = header_.data_offset;
+		}
 
-		fread(header_.data + header_.data_offset, 1, file.size, fp);
-		fclose(fp);
+		// file data is read later, by ReadData() if streamed, otherwise all at once by CreateRomfs()
+		struct sRomfsPayload payload;
+		payload.path = file.path;
+		payload.offset = header_.data_offset;
+		payload.size = file.size;
+		payload.mtime = file.mtime;
+		payload_.push_back(payload);
 	}
 
-	header_.data_offset += file.size;
+	if (duplicate == duplicate_.end())
+	{
+		header_.data_offset += file.size;
+	}
 	header_.file_entry_offset += (sizeof(struct sRomfsFileEntry) + align(file.namesize, 4));
 
 	return 0;
-}
\ No newline at end of file
+}
+
+int Romfs::ReadData(u8* out, size_t size)
+{
+	size_t read_size;
+
+	if (read_pos_ + size > data_size_) die("[ERROR] Attempted to read beyond the end of the romfs.");
+
+	// data held in memory (the metadata, or everything when not streamed)
+	if (read_pos_ < data_.size())
+	{
+		read_size = (size < data_.size() - read_pos_) ? size : (size_t)(data_.size() - read_pos_);
+		memcpy(out, data_.data_const() + read_pos_, read_size);
+
+		out += read_size;
+		size -= read_size;
+		read_pos_ += read_size;
+	}
+
+	// file data that is streamed from disk
+	if (size > 0)
+	{
+		safe_call(ReadPayloads(out, read_pos_ - data_.size(), size));
+		read_pos_ += size;
+	}
+
+	return 0;
+}
+
+// read size bytes of the data region from data_pos, all the files in it are read at once across the thread pool.
+// reads have to be sequential
+int Romfs::ReadPayloads(u8* out, u64 data_pos, u64 size)
+{
+	std::vector<struct sReadTask> task;
+	u64 end = data_pos + size;
+
+	// move past files which have been completely read
+	while (read_payload_ < payload_.size() && data_pos >= payload_[read_payload_].offset + payload_[read_payload_].size)
+	{
+		read_payload_++;
+	}
+
+	// the padding between files is zero
+	memset(out, 0, size);
+
+	for (size_t i = read_payload_; i < payload_.size() && payload_[i].offset < end; i++)
+	{
+		u64 from = (payload_[i].offset > data_pos) ? payload_[i].offset : data_pos;
+		u64 to = (payload_[i].offset + payload_[i].size < end) ? payload_[i].offset + payload_[i].size : end;
+
+		for (u64 pos = from; pos < to; pos += kReadTaskSize)
+		{
+			struct sReadTask read;
+			read.path = payload_[i].path;
+			read.file_offset = pos - payload_[i].offset;
+			read.out = out + (pos - data_pos);
+			read.size = (to - pos < kReadTaskSize) ? (size_t)(to - pos) : kReadTaskSize;
+			task.push_back(read);
+		}
+	}
+
+	return pool_.Run(ReadFileTask, &task, task.size());
+}
@@ -1,20 +1,56 @@
 #pragma once
+#include <map>
 #include "types.h"
 #include "ByteBuffer.h"
+#include "crypto.h"
+#include "thread_pool.h"
 #include "romfs_dir_scanner.h"
 
+// hash of an entry name in the romfs hash tables, parent is the offset of the parent directory entry
+u32 CalcPathHash(u32 parent, const utf16char_t* path);
+
 class Romfs
 {
 public:
+	// file data, which is read from disk into the data region
+	struct sRomfsPayload
+	{
+		const oschar_t* path;
+		u64 offset; // from the start of the data region
+		u64 size;
+		u64 mtime;
+	};
+
 	Romfs();
 	~Romfs();
 
+	// size of the window used when streaming romfs data to a file
+	static const u32 kStreamBlockSize = 0x100000;
+	// files are read in pieces of at most this size, so large files are also read by several threads
+	static const u32 kReadTaskSize = 0x40000;
+
 	// creating romfs from directory path
-	int CreateRomfs(const char* dir);
-	
+	// if is_streamed is set, only the romfs metadata is kept in memory
+	// and file data is read from disk on demand by ReadData()
+	int CreateRomfs(const char* dir, bool is_streamed = false);
+
+	// store the data of identical files once, this reads every file whose size matches another one's
+	inline void SetIsDeduplicated(bool is_deduplicated) { is_deduplicated_ = is_deduplicated; }
+	// number of files read at once, 0 uses one thread per cpu core
+	inline void SetThreadNum(int thread_num) { pool_.SetThreadNum(thread_num); }
+
+	// read the romfs sequentially, works for both in memory and streamed romfs
+	int ReadData(u8* out, size_t size);
+
+	inline bool is_streamed() const { return is_streamed_; }
+	// only valid if the romfs isn't streamed
 	inline const u8* data_blob() const { return data_.data_const(); }
-	inline u64 data_size() const { return data_.size(); }
-private:
+	inline u64 data_size() const { return data_size_; }
+	// only valid if the romfs is streamed, the file data follows the metadata
+	inline u64 metadata_size() const { return data_.size(); }
+	inline const std::vector<struct sRomfsPayload>& payload() const { return payload_; }
+
+	// on-disk format, also used to read a romfs back
 	static const int kRomfsSectionNum = 4;
 	static const u32 kUnusedOffset = 0xffffffff;
 
@@ -59,6 +95,7 @@ private:
 	};
 #pragma pack (pop)
 
+private:
 	struct sRomfsHeaderPointers {
 		u32 dir_hash_num;
 		u32* dir_hash_table;	
@@ -77,7 +114,23 @@ private:
 	} header_;
 	
 	RomfsDirScanner scanner_;
-	ByteBuffer data_; // raw romfs filesystem
+
+	// deduplication, files are mapped to the first identical file in the data region
+	bool is_deduplicated_;
+	std::map<const struct RomfsDirScanner::sFile*, const struct RomfsDirScanner::sFile*> duplicate_;
+	std::map<const struct RomfsDirScanner::sFile*, u64> stored_offset_;
+
+	// files are read, and hashed for deduplication, across the pool
+	ThreadPool pool_;
+
+	ByteBuffer data_; // raw romfs filesystem, or only the metadata if streamed
+	u64 data_size_;
+
+	// streaming state
+	bool is_streamed_;
+	std::vector<struct sRomfsPayload> payload_;
+	u64 read_pos_;
+	size_t read_payload_;
 
 	u32 GetDirNum(const struct RomfsDirScanner::sDirectory& dir);
 	u32 GetFileNum(const struct RomfsDirScanner::sDirectory& dir);
@@ -87,7 +140,12 @@ private:
 
 	int CreateRomfsLayout();
 
+	void GetFileList(const struct RomfsDirScanner::sDirectory& dir, std::vector<const struct RomfsDirScanner::sFile*>& list);
+	int FindDuplicates();
+
 	void AddDirToRomfs(const struct RomfsDirScanner::sDirectory& dir, u32 parent, u32 sibling);
 	int AddDirChildToRomfs(const struct RomfsDirScanner::sDirectory& dir, u32 parent, u32 diroff);
 	int AddFileToRomfs(const RomfsDirScanner::sFile& file, u32 parent, u32 sibling);
+
+	int ReadPayloads(u8* out, u64 data_pos, u64 size);
 };
\ No newline at end of file
@@ -1,8 +1,31 @@
 #include <cstdlib>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "romfs_dir_scanner.h"
 
 #define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
 
+// names are compared by UTF-16 code unit, like Nintendo's tools order them
+static bool IsNameLess(const utf16char_t* a, const utf16char_t* b)
+{
+	while (*a != 0 && *a == *b)
+	{
+		a++;
+		b++;
+	}
+
+	return (u16)*a < (u16)*b;
+}
+
+template <class T>
+static bool IsEntryLess(const T& a, const T& b)
+{
+	return IsNameLess(a.name, b.name);
+}
+
 RomfsDirScanner::RomfsDirScanner()
 {
 	InitDirectory(root_);
@@ -20,7 +43,33 @@ int RomfsDirScanner::ScanDir(const char* root)
 	root_.name = utf16_CopyStr(EMPTY_PATH);
 	root_.namesize = 0;
 
-	return PopulateDir(root_);
+	safe_call(PopulateDir(root_));
+
+	// the tree is walked one depth at a time, with the directories of a depth read in parallel.
+	// every directory sorts its own entries, so the tree doesn't depend on readdir order
+	// or on how the directories were spread over the threads
+	level_.clear();
+	level_.push_back(&root_);
+	while (true)
+	{
+		std::vector<struct sDirectory*> next;
+		for (size_t i = 0; i < level_.size(); i++)
+		{
+			for (size_t j = 0; j < level_[i]->child.size(); j++)
+			{
+				next.push_back(&level_[i]->child[j]);
+			}
+		}
+
+		if (next.empty())
+			break;
+
+		level_.swap(next);
+		pool_.Run(PopulateDirTask, this, level_.size());
+	}
+	level_.clear();
+
+	return 0;
 }
 
 void RomfsDirScanner::InitDirectory(struct RomfsDirScanner::sDirectory& dir)
@@ -73,15 +122,58 @@ void RomfsDirScanner::FreeDirectory(struct RomfsDirScanner::sDirectory& dir)
 	InitDirectory(dir);
 }
 
+int RomfsDirScanner::PopulateDirTask(void* arg, size_t index)
+{
+	RomfsDirScanner* scanner = (RomfsDirScanner*)arg;
+
+	// a directory that can't be read is left empty, the rest of the tree is still scanned
+	scanner->PopulateDir(*scanner->level_[index]);
+
+	return 0;
+}
+
+void RomfsDirScanner::AddEntry(struct RomfsDirScanner::sDirectory& dir, const oschar_t* name, bool is_dir, u64 size, u64 mtime)
+{
+	if (is_dir)
+	{
+		struct sDirectory child;
+		InitDirectory(child);
+		child.path = os_AppendToPath(dir.path, name);
+		child.name = utf16_CopyConvertOsStr(name);
+		child.namesize = utf16_strlen(child.name)*sizeof(utf16char_t);
+		dir.child.push_back(child);
+	}
+	else
+	{
+		struct sFile file;
+		file.path = os_AppendToPath(dir.path, name);
+		file.name = utf16_CopyConvertOsStr(name);
+		file.namesize = utf16_strlen(file.name)*sizeof(utf16char_t);
+		file.size = size;
+		file.mtime = mtime;
+		dir.file.push_back(file);
+	}
+}
+
 int RomfsDirScanner::PopulateDir(struct RomfsDirScanner::sDirectory& dir)
 {
 	_OSDIR *dp;
 	struct _osstat st;
 	struct _osdirent *entry;
 
+#ifdef _WIN32
 	// Open Directory
 	if ((dp = os_opendir(dir.path)) == NULL)
+#else
+	// entries are looked up relative to the open directory, rather than resolving their full path
+	int dir_fd = open(dir.path, O_RDONLY | O_DIRECTORY);
+	if (dir_fd < 0 || (dp = fdopendir(dir_fd)) == NULL)
+#endif
 	{
+#ifndef _WIN32
+		if (dir_fd >= 0)
+			close(dir_fd);
+#endif
 		printf("[ERROR] Failed to open directory: \"");
 		os_fputs(dir.path, stdout);
 		printf("\"\n");
@@ -95,34 +187,40 @@ int RomfsDirScanner::PopulateDir(struct RomfsDirScanner::sDirectory& dir)
 		if (entry->d_name[0] == (oschar_t)'.')
 			continue;
 
-		// Get native FS path
+#ifdef _WIN32
 		oschar_t *path = os_AppendToPath(dir.path, entry->d_name);
+		bool found = os_stat(path, &st) == 0;
+		free(path);
+#else
+#ifdef DT_DIR
+		// the entry type usually says it's a directory without a stat at all
+		if (entry->d_type == DT_DIR)
+		{
+			AddEntry(dir, entry->d_name, true, 0, 0);
+			continue;
+		}
+#endif
+		// one stat gives both the type of links and unknown entries, and the size of files
+		bool found = fstatat(dir_fd, entry->d_name, &st, 0) == 0;
+#endif
 
-		// Opening directory with fs path to test if directory
-		if (os_stat(path, &st) == 0 && S_IFDIR&st.st_mode) {
-			struct sDirectory child;
-			child.path = path;
-			child.name = utf16_CopyConvertOsStr(entry->d_name);
-			child.namesize = utf16_strlen(child.name)*sizeof(utf16char_t);
-
-			// populate child
-			PopulateDir(child);
-
-			// add to parent struct
-			dir.child.push_back(child);
+		// anything that can't be stat'd is treated as an empty file
+		if (found && S_IFDIR&st.st_mode)
+		{
+			AddEntry(dir, entry->d_name, true, 0, 0);
 		}
-		// Otherwise this is a file
-		else {
-			struct sFile file;
-			file.path = path;
-			file.name = utf16_CopyConvertOsStr(entry->d_name);
-			file.namesize = utf16_strlen(file.name)*sizeof(utf16char_t);
-			file.size = os_fsize(path);
-			dir.file.push_back(file);
+		else
+		{
+			AddEntry(dir, entry->d_name, false, found ? st.st_size : 0, found ? st.st_mtime : 0);
 		}
 	}
 
+	// this also closes dir_fd
 	os_closedir(dp);
 
+	// readdir order differs between filesystems, sort so the same input always gives the same romfs
+	std::sort(dir.child.begin(), dir.child.end(), IsEntryLess<struct sDirectory>);
+	std::sort(dir.file.begin(), dir.file.end(), IsEntryLess<struct sFile>);
+
 	return 0;
 }
\ No newline at end of file
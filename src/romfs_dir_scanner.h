@@ -2,6 +2,7 @@
 #include <vector>
 #include "oschar.h"
 #include "types.h"
+#include "thread_pool.h"
 
 class RomfsDirScanner
 {
@@ -12,6 +13,7 @@ public:
 		utf16char_t* name;
 		u32 namesize;
 		u64 size;
+		u64 mtime;
 	};
 
 	struct sDirectory
@@ -34,7 +36,14 @@ public:
 private:
 	struct sDirectory root_;
 
+	// directories at the depth being scanned, each is read by one thread
+	std::vector<struct sDirectory*> level_;
+	ThreadPool pool_;
+
 	void InitDirectory(struct sDirectory& dir);
 	void FreeDirectory(struct sDirectory& dir);
+	static int PopulateDirTask(void* arg, size_t index);
+	// read the entries of a directory, but not of its children
 	int PopulateDir(struct sDirectory& dir);
+	void AddEntry(struct sDirectory& dir, const oschar_t* name, bool is_dir, u64 size, u64 mtime);
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <sys/stat.h>
+#include "romfs_manifest.h"
+
+#define MANIFEST_MAGIC "romfs-manifest"
+
+static void HashToHex(const u8 hash[Crypto::kSha256HashLen], char hex[Crypto::kSha256HashLen * 2 + 1])
+{
+	for (int i = 0; i < Crypto::kSha256HashLen; i++)
+	{
+		sprintf(hex + i * 2, "%02x", hash[i]);
+	}
+}
+
+static int HexToHash(const char* hex, u8 hash[Crypto::kSha256HashLen])
+{
+	if (strlen(hex) != Crypto::kSha256HashLen * 2)
+		return 1;
+
+	for (int i = 0; i < Crypto::kSha256HashLen; i++)
+	{
+		unsigned int byte;
+		if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+			return 1;
+		hash[i] = byte;
+	}
+
+	return 0;
+}
+
+// read the rest of the line, after the separating space
+static void ReadLine(FILE* fp, std::string& str)
+{
+	int c = fgetc(fp);
+
+	str.clear();
+	if (c == ' ')
+		c = fgetc(fp);
+	while (c != EOF && c != '\n')
+	{
+		str += (char)c;
+		c = fgetc(fp);
+	}
+}
+
+RomfsManifest::RomfsManifest() :
+	romfs_offset_(0),
+	romfs_size_(0),
+	metadata_size_(0),
+	output_size_(0),
+	output_mtime_(0),
+	build_time_(0),
+	hash_entry_(0)
+{
+	memset(metadata_hash_, 0, Crypto::kSha256HashLen);
+}
+
+RomfsManifest::~RomfsManifest()
+{
+}
+
+void RomfsManifest::CreateManifest(const char* romfs_dir, u64 romfs_offset, const Romfs& romfs, u64 build_time)
+{
+	romfs_dir_ = romfs_dir;
+	romfs_offset_ = romfs_offset;
+	romfs_size_ = romfs.data_size();
+	metadata_size_ = romfs.metadata_size();
+	Crypto::Sha256(romfs.data_blob(), metadata_size_, metadata_hash_);
+	build_time_ = build_time;
+
+	entry_.clear();
+	for (size_t i = 0; i < romfs.payload().size(); i++)
+	{
+		struct sEntry entry;
+		entry.path = romfs.payload()[i].path;
+		entry.offset = romfs.payload()[i].offset;
+		entry.size = romfs.payload()[i].size;
+		entry.mtime = romfs.payload()[i].mtime;
+		memset(entry.hash, 0, Crypto::kSha256HashLen);
+		entry_.push_back(entry);
+	}
+
+	hash_entry_ = 0;
+}
+
+void RomfsManifest::HashLevel2(const u8* data, u64 pos, u64 size)
+{
+	u64 end = pos + size;
+
+	while (hash_entry_ < entry_.size())
+	{
+		struct sEntry& entry = entry_[hash_entry_];
+		u64 start = metadata_size_ + entry.offset;
+		u64 stop = start + entry.size;
+
+		if (start >= end)
+			break;
+
+		// the file starts in this data
+		if (start >= pos)
+			Crypto::Sha256Init(hash_ctx_);
+
+		u64 from = (start > pos) ? start : pos;
+		u64 to = (stop < end) ? stop : end;
+		Crypto::Sha256Update(hash_ctx_, data + (from - pos), to - from);
+
+		// the file continues past this data
+		if (to != stop)
+			break;
+
+		Crypto::Sha256Final(hash_ctx_, entry.hash);
+		hash_entry_++;
+	}
+}
+
+int RomfsManifest::LoadManifest(const char* path)
+{
+	FILE* fp;
+	char keyword[0x20], hex[Crypto::kSha256HashLen * 2 + 1];
+	int version;
+
+	entry_.clear();
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return 1;
+
+	if (fscanf(fp, "%31s %d", keyword, &version) != 2 || strcmp(keyword, MANIFEST_MAGIC) != 0 || version != kVersion)
+	{
+		fclose(fp);
+		return 1;
+	}
+
+	while (fscanf(fp, "%31s", keyword) == 1)
+	{
+		int ret = 0;
+		std::string rest;
+
+		if (strcmp(keyword, "output") == 0)
+		{
+			ret = fscanf(fp, "%" SCNu64 " %" SCNu64, &output_size_, &output_mtime_) != 2;
+		}
+		else if (strcmp(keyword, "layout") == 0)
+		{
+			ret = fscanf(fp, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %64s", &romfs_offset_, &romfs_size_, &metadata_size_, hex) != 4 || HexToHash(hex, metadata_hash_) != 0;
+		}
+		else if (strcmp(keyword, "dir") == 0)
+		{
+			ReadLine(fp, romfs_dir_);
+			continue;
+		}
+		else if (strcmp(keyword, "file") == 0)
+		{
+			struct sEntry entry;
+			entry.path = NULL;
+			ret = fscanf(fp, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %64s", &entry.offset, &entry.size, &entry.mtime, hex) != 4 || HexToHash(hex, entry.hash) != 0;
+			entry_.push_back(entry);
+		}
+		else
+		{
+			ret = 1;
+		}
+
+		if (ret != 0)
+		{
+			entry_.clear();
+			fclose(fp);
+			return 1;
+		}
+
+		// the rest of the line is only for people reading the manifest
+		ReadLine(fp, rest);
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+int RomfsManifest::SaveManifest(const char* path, const char* out_file)
+{
+	FILE* fp;
+	char hex[Crypto::kSha256HashLen * 2 + 1];
+
+	if (GetFileStat(out_file, output_size_, output_mtime_) != 0)
+	{
+		fprintf(stderr, "[ERROR] Failed to stat output file: %s\n", out_file);
+		return 1;
+	}
+
+	if ((fp = fopen(path, "w")) == NULL)
+	{
+		fprintf(stderr, "[ERROR] Failed to create romfs manifest: %s\n", path);
+		return 1;
+	}
+
+	fprintf(fp, "%s %d\n", MANIFEST_MAGIC, kVersion);
+	fprintf(fp, "output %" PRIu64 " %" PRIu64 "\n", output_size_, output_mtime_);
+	HashToHex(metadata_hash_, hex);
+	fprintf(fp, "layout %" PRIu64 " %" PRIu64 " %" PRIu64 " %s\n", romfs_offset_, romfs_size_, metadata_size_, hex);
+	fprintf(fp, "dir %s\n", romfs_dir_.c_str());
+	for (size_t i = 0; i < entry_.size(); i++)
+	{
+		HashToHex(entry_[i].hash, hex);
+		// a recent mtime is written as 0, so the file is rehashed by the next build
+		fprintf(fp, "file %" PRIu64 " %" PRIu64 " %" PRIu64 " %s", entry_[i].offset, entry_[i].size, entry_[i].mtime >= build_time_ ? 0 : entry_[i].mtime, hex);
+		if (entry_[i].path != NULL)
+		{
+			fputc(' ', fp);
+			os_fputs(entry_[i].path, fp);
+		}
+		fputc('\n', fp);
+	}
+
+	if (ferror(fp))
+	{
+		fclose(fp);
+		fprintf(stderr, "[ERROR] Failed to write romfs manifest: %s\n", path);
+		return 1;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+bool RomfsManifest::IsSameLayout(const RomfsManifest& other) const
+{
+	if (romfs_dir_ != other.romfs_dir_ || romfs_offset_ != other.romfs_offset_ || romfs_size_ != other.romfs_size_ || metadata_size_ != other.metadata_size_ || memcmp(metadata_hash_, other.metadata_hash_, Crypto::kSha256HashLen) != 0 || entry_.size() != other.entry_.size())
+		return false;
+
+	for (size_t i = 0; i < entry_.size(); i++)
+	{
+		if (entry_[i].offset != other.entry_[i].offset || entry_[i].size != other.entry_[i].size)
+			return false;
+	}
+
+	return true;
+}
+
+bool RomfsManifest::IsOutputUnchanged(const char* out_file) const
+{
+	u64 size, mtime;
+
+	return GetFileStat(out_file, size, mtime) == 0 && size == output_size_ && mtime == output_mtime_;
+}
+
+int RomfsManifest::GetFileStat(const char* path, u64& size, u64& mtime) const
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		return 1;
+
+	size = st.st_size;
+	mtime = st.st_mtime;
+
+	return 0;
+}
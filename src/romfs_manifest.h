@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "types.h"
+#include "crypto.h"
+#include "romfs.h"
+
+// record of where each romfs file was placed in a built image, and what it contained.
+// a later build with the same layout only has to write and rehash the files that changed
+class RomfsManifest
+{
+public:
+	struct sEntry
+	{
+		const oschar_t* path; // NULL if the manifest was loaded
+		u64 offset; // from the start of the romfs data region
+		u64 size;
+		u64 mtime;
+		u8 hash[Crypto::kSha256HashLen];
+	};
+
+	RomfsManifest();
+	~RomfsManifest();
+
+	// describe a streamed romfs placed at romfs_offset in the output, file hashes are filled in by HashLevel2()
+	// files modified at or after build_time may still change within the same second, so their mtime isn't trusted later
+	void CreateManifest(const char* romfs_dir, u64 romfs_offset, const Romfs& romfs, u64 build_time);
+
+	// hash the files in level2 data, which has to be passed in order
+	void HashLevel2(const u8* data, u64 pos, u64 size);
+
+	// returns non-zero if there's no usable manifest at path
+	int LoadManifest(const char* path);
+	// out_file is the image that was just written
+	int SaveManifest(const char* path, const char* out_file);
+
+	// the romfs of both manifests have the same files, at the same offsets
+	bool IsSameLayout(const RomfsManifest& other) const;
+	// out_file hasn't been touched since the manifest was saved
+	bool IsOutputUnchanged(const char* out_file) const;
+
+	inline u64 metadata_size() const { return metadata_size_; }
+	inline std::vector<struct sEntry>& entry() { return entry_; }
+	inline const std::vector<struct sEntry>& entry() const { return entry_; }
+private:
+	static const int kVersion = 1;
+
+	std::string romfs_dir_;
+	u64 romfs_offset_;
+	u64 romfs_size_;
+	u64 metadata_size_;
+	u8 metadata_hash_[Crypto::kSha256HashLen];
+	u64 output_size_;
+	u64 output_mtime_;
+	u64 build_time_;
+	std::vector<struct sEntry> entry_;
+
+	// hashing state
+	size_t hash_entry_;
+	struct Crypto::sSha256Context hash_ctx_;
+
+	int GetFileStat(const char* path, u64& size, u64& mtime) const;
+};
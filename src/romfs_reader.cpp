@@ -0,0 +1,402 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "romfs_reader.h"
+#include "ncch_header.h"
+#include "ivfc.h"
+#include "3dsx.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+// the 3dsx extended header follows the base header
+static const u32 k3dsxExtHeaderSize = 0xC;
+static const u32 k3dsxRomfsOffsetPos = sizeof(_3DSX_Header) + 8;
+
+RomfsReader::RomfsReader() :
+	ivfc_image_(NULL),
+	ivfc_image_size_(0),
+	is_verifying_(false),
+	romfs_(NULL),
+	romfs_size_(0),
+	data_offset_(0),
+	dir_hash_table_(NULL),
+	dir_hash_num_(0),
+	dir_table_(NULL),
+	dir_table_size_(0),
+	file_hash_table_(NULL),
+	file_hash_num_(0),
+	file_table_(NULL),
+	file_table_size_(0)
+{
+	memset(&ivfc_, 0, sizeof(ivfc_));
+	pthread_mutex_init(&verify_lock_, NULL);
+}
+
+RomfsReader::~RomfsReader()
+{
+	pthread_mutex_destroy(&verify_lock_);
+}
+
+int RomfsReader::Open(const char* path)
+{
+	if (image_.Open(path) != 0)
+	{
+		fprintf(stderr, "[ERROR] Failed to open image: %s\n\n", path);
+		return 1;
+	}
+
+	return FindRomfs();
+}
+
+int RomfsReader::FindDir(const char* path, u32& dir) const
+{
+	return FindEntry(path, false, dir);
+}
+
+int RomfsReader::FindFile(const char* path, u32& file) const
+{
+	return FindEntry(path, true, file);
+}
+
+const struct Romfs::sRomfsDirEntry* RomfsReader::GetDir(u32 dir) const
+{
+	if (dir > dir_table_size_ || dir_table_size_ - dir < sizeof(struct Romfs::sRomfsDirEntry))
+		return NULL;
+
+	const struct Romfs::sRomfsDirEntry* entry = (const struct Romfs::sRomfsDirEntry*)(dir_table_ + dir);
+	if (le_word(entry->name_size) > dir_table_size_ - dir - sizeof(struct Romfs::sRomfsDirEntry))
+		return NULL;
+
+	return entry;
+}
+
+const struct Romfs::sRomfsFileEntry* RomfsReader::GetFile(u32 file) const
+{
+	if (file > file_table_size_ || file_table_size_ - file < sizeof(struct Romfs::sRomfsFileEntry))
+		return NULL;
+
+	const struct Romfs::sRomfsFileEntry* entry = (const struct Romfs::sRomfsFileEntry*)(file_table_ + file);
+	if (le_word(entry->name_size) > file_table_size_ - file - sizeof(struct Romfs::sRomfsFileEntry))
+		return NULL;
+
+	return entry;
+}
+
+const u8* RomfsReader::GetFileData(u32 file) const
+{
+	const struct Romfs::sRomfsFileEntry* entry = GetFile(file);
+	if (entry == NULL)
+		return NULL;
+
+	u64 offset = le_dword(entry->data_offset);
+	u64 size = le_dword(entry->data_size);
+	if (offset > romfs_size_ - data_offset_ || size > romfs_size_ - data_offset_ - offset)
+		return NULL;
+
+	return romfs_ + data_offset_ + offset;
+}
+
+oschar_t* RomfsReader::GetDirName(u32 dir) const
+{
+	const struct Romfs::sRomfsDirEntry* entry = GetDir(dir);
+	if (entry == NULL)
+		return NULL;
+
+	return CopyName((const u8*)(entry + 1), le_word(entry->name_size));
+}
+
+oschar_t* RomfsReader::GetFileName(u32 file) const
+{
+	const struct Romfs::sRomfsFileEntry* entry = GetFile(file);
+	if (entry == NULL)
+		return NULL;
+
+	return CopyName((const u8*)(entry + 1), le_word(entry->name_size));
+}
+
+int RomfsReader::EnableVerification()
+{
+	if (ivfc_image_ == NULL) die("[ERROR] The romfs has no IVFC hash tree to verify.");
+
+	if (ivfc_.master_hash_offset + ivfc_.master_hash_size > ivfc_image_size_) die("[ERROR] IVFC master hashes are outside of the image.");
+	for (int i = 0; i < Ivfc::kLevelNum; i++)
+	{
+		// whole blocks are hashed, including the padding after the level
+		u64 size = align(ivfc_.level[i].size, ivfc_.level[i].block_size);
+		if (ivfc_.level[i].offset > ivfc_image_size_ || size > ivfc_image_size_ - ivfc_.level[i].offset) die("[ERROR] IVFC level is outside of the image.");
+
+		is_block_verified_[i].assign(size / ivfc_.level[i].block_size, 0);
+	}
+	is_verifying_ = true;
+
+	// the lookups trust the tables, so they are checked before anything is read
+	if (VerifyRomfs(0, data_offset_) != 0) die("[ERROR] Romfs metadata doesn't match the IVFC hash tree.");
+
+	return 0;
+}
+
+int RomfsReader::VerifyFileData(u32 file, u64 offset, u64 size)
+{
+	if (!is_verifying_)
+		return 0;
+
+	const struct Romfs::sRomfsFileEntry* entry = GetFile(file);
+	if (entry == NULL || offset > le_dword(entry->data_size) || size > le_dword(entry->data_size) - offset)
+		return 1;
+
+	return VerifyRomfs(data_offset_ + le_dword(entry->data_offset) + offset, size);
+}
+
+int RomfsReader::FindRomfs()
+{
+	const u8* image = image_.data();
+	u64 size = image_.size();
+	u64 offset = 0;
+
+	if (size >= 0x200 && memcmp(image + 0x100, "NCCH", 4) == 0)
+	{
+		NcchHeader header;
+		safe_call(header.SetHeader(image));
+
+		if (header.is_encrypted()) die("[ERROR] The NCCH is encrypted.");
+		if (header.romfs_offset() == 0 || header.romfs_offset() >= size) die("[ERROR] The NCCH has no romfs.");
+		offset = header.romfs_offset();
+	}
+	else if (size >= k3dsxRomfsOffsetPos + 4 && le_word(((const _3DSX_Header*)image)->magic) == _3DSX_MAGIC)
+	{
+		if (le_hword(((const _3DSX_Header*)image)->headerSize) < sizeof(_3DSX_Header) + k3dsxExtHeaderSize) die("[ERROR] The 3DSX has no romfs.");
+
+		// the 3dsx romfs has no hash tree
+		u64 romfs_offset = le_word(*(const u32*)(image + k3dsxRomfsOffsetPos));
+		if (romfs_offset == 0 || romfs_offset >= size) die("[ERROR] The 3DSX has no romfs.");
+		return SetRomfs(image + romfs_offset, size - romfs_offset);
+	}
+
+	// an ivfc image holds the romfs in level2
+	if (Ivfc::GetImageGeometry(image + offset, size - offset, ivfc_) == 0)
+	{
+		ivfc_image_ = image + offset;
+		ivfc_image_size_ = size - offset;
+		return SetRomfs(ivfc_image_ + ivfc_.level[2].offset, ivfc_.level[2].size);
+	}
+	else if (offset > 0)
+	{
+		die("[ERROR] The romfs has no IVFC header.");
+	}
+
+	return SetRomfs(image, size);
+}
+
+int RomfsReader::SetRomfs(const u8* romfs, u64 size)
+{
+	const struct Romfs::sRomfsHeader* hdr = (const struct Romfs::sRomfsHeader*)romfs;
+
+	if (size < sizeof(struct Romfs::sRomfsHeader) || le_word(hdr->header_size) != sizeof(struct Romfs::sRomfsHeader)) die("[ERROR] Not a romfs.");
+
+	for (int i = 0; i < Romfs::kRomfsSectionNum; i++)
+	{
+		if (le_word(hdr->section[i].offset) > size || le_word(hdr->section[i].size) > size - le_word(hdr->section[i].offset)) die("[ERROR] Romfs section is outside of the romfs.");
+	}
+	if (le_word(hdr->data_offset) > size) die("[ERROR] Romfs data is outside of the romfs.");
+
+	romfs_ = romfs;
+	romfs_size_ = size;
+	data_offset_ = le_word(hdr->data_offset);
+
+	dir_hash_table_ = (const u32*)(romfs + le_word(hdr->section[Romfs::ROMFS_SECTION_DIR_HASH_TABLE].offset));
+	dir_hash_num_ = le_word(hdr->section[Romfs::ROMFS_SECTION_DIR_HASH_TABLE].size) / sizeof(u32);
+	dir_table_ = romfs + le_word(hdr->section[Romfs::ROMFS_SECTION_DIR_ENTRY_TABLE].offset);
+	dir_table_size_ = le_word(hdr->section[Romfs::ROMFS_SECTION_DIR_ENTRY_TABLE].size);
+	file_hash_table_ = (const u32*)(romfs + le_word(hdr->section[Romfs::ROMFS_SECTION_FILE_HASH_TABLE].offset));
+	file_hash_num_ = le_word(hdr->section[Romfs::ROMFS_SECTION_FILE_HASH_TABLE].size) / sizeof(u32);
+	file_table_ = romfs + le_word(hdr->section[Romfs::ROMFS_SECTION_FILE_ENTRY_TABLE].offset);
+	file_table_size_ = le_word(hdr->section[Romfs::ROMFS_SECTION_FILE_ENTRY_TABLE].size);
+
+	if (dir_hash_num_ == 0 || GetDir(0) == NULL) die("[ERROR] Romfs has no root directory.");
+
+	return 0;
+}
+
+int RomfsReader::FindEntry(const char* path, bool is_file, u32& entry) const
+{
+	std::vector<std::string> component;
+	std::string name;
+
+	for (const char* c = path; ; c++)
+	{
+		if (*c == '/' || *c == '\0')
+		{
+			if (!name.empty())
+				component.push_back(name);
+			name.clear();
+		}
+		else
+		{
+			name += *c;
+		}
+
+		if (*c == '\0')
+			break;
+	}
+
+	// the root is the only directory without a name
+	if (component.empty())
+	{
+		entry = 0;
+		return is_file ? 1 : 0;
+	}
+
+	u32 dir = 0;
+	for (size_t i = 0; i < component.size(); i++)
+	{
+#ifdef _WIN32
+		utf16char_t* utf16_name = strcopy_8to16(component[i].c_str());
+#else
+		utf16char_t* utf16_name = strcopy_UTF8toUTF16(component[i].c_str());
+#endif
+		if (utf16_name == NULL)
+			return 1;
+
+		bool is_last = i == component.size() - 1;
+		int ret = LookupEntry(dir, utf16_name, is_file && is_last, is_last ? entry : dir);
+		free(utf16_name);
+
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int RomfsReader::LookupEntry(u32 parent, const utf16char_t* name, bool is_file, u32& entry) const
+{
+	u32 hash_num = is_file ? file_hash_num_ : dir_hash_num_;
+	const u32* hash_table = is_file ? file_hash_table_ : dir_hash_table_;
+
+	if (hash_num == 0)
+		return 1;
+
+	// a hash chain can't be longer than the number of entries, unless the romfs is corrupt
+	u32 max_len = is_file ? file_table_size_ / sizeof(struct Romfs::sRomfsFileEntry) : dir_table_size_ / sizeof(struct Romfs::sRomfsDirEntry);
+	u32 offset = le_word(hash_table[CalcPathHash(parent, name) % hash_num]);
+	for (u32 i = 0; offset != Romfs::kUnusedOffset && i < max_len; i++)
+	{
+		if (is_file)
+		{
+			const struct Romfs::sRomfsFileEntry* file = GetFile(offset);
+			if (file == NULL)
+				return 1;
+			if (le_word(file->parent_offset) == parent && IsSameName((const u8*)(file + 1), le_word(file->name_size), name))
+			{
+				entry = offset;
+				return 0;
+			}
+			offset = le_word(file->hash_offset);
+		}
+		else
+		{
+			const struct Romfs::sRomfsDirEntry* dir = GetDir(offset);
+			if (dir == NULL)
+				return 1;
+			if (le_word(dir->parent_offset) == parent && IsSameName((const u8*)(dir + 1), le_word(dir->name_size), name))
+			{
+				entry = offset;
+				return 0;
+			}
+			offset = le_word(dir->hash_offset);
+		}
+	}
+
+	return 1;
+}
+
+bool RomfsReader::IsSameName(const u8* name, u32 name_size, const utf16char_t* other) const
+{
+	u32 len = name_size / sizeof(u16);
+
+	for (u32 i = 0; i < len; i++)
+	{
+		if (other[i] == 0 || le_hword(((const u16*)name)[i]) != (u16)other[i])
+			return false;
+	}
+
+	return other[len] == 0;
+}
+
+oschar_t* RomfsReader::CopyName(const u8* name, u32 name_size) const
+{
+	u32 len = name_size / sizeof(u16);
+	utf16char_t* utf16_name = (utf16char_t*)calloc(len + 1, sizeof(utf16char_t));
+	if (utf16_name == NULL)
+		return NULL;
+
+	// names that could escape the directory they are extracted to are refused
+	bool is_safe = len > 0;
+	for (u32 i = 0; i < len; i++)
+	{
+		utf16_name[i] = le_hword(((const u16*)name)[i]);
+		if (utf16_name[i] == '/' || utf16_name[i] == '\\' || utf16_name[i] == ':')
+			is_safe = false;
+	}
+	if ((len == 1 && utf16_name[0] == '.') || (len == 2 && utf16_name[0] == '.' && utf16_name[1] == '.'))
+		is_safe = false;
+
+	oschar_t* os_name = is_safe ? os_CopyConvertUTF16Str(utf16_name) : NULL;
+	free(utf16_name);
+
+	return os_name;
+}
+
+int RomfsReader::VerifyRomfs(u64 pos, u64 size)
+{
+	if (size == 0)
+		return 0;
+
+	u64 block_size = ivfc_.level[2].block_size;
+	for (u64 block = pos / block_size; block <= (pos + size - 1) / block_size; block++)
+	{
+		safe_call(VerifyBlock(2, block));
+	}
+
+	return 0;
+}
+
+int RomfsReader::VerifyBlock(int level, u64 block)
+{
+	if (block >= is_block_verified_[level].size())
+		return 1;
+
+	pthread_mutex_lock(&verify_lock_);
+	bool is_verified = is_block_verified_[level][block] != 0;
+	pthread_mutex_unlock(&verify_lock_);
+	if (is_verified)
+		return 0;
+
+	// level0 is hashed by the master hashes in the header, the other levels by the level above them.
+	// two threads reading the same block both hash it, which is harmless
+	u64 hash_pos = block * Crypto::kSha256HashLen;
+	const u8* expected;
+	if (level == 0)
+	{
+		if (hash_pos + Crypto::kSha256HashLen > ivfc_.master_hash_size)
+			return 1;
+		expected = ivfc_image_ + ivfc_.master_hash_offset + hash_pos;
+	}
+	else
+	{
+		safe_call(VerifyBlock(level - 1, hash_pos / ivfc_.level[level - 1].block_size));
+		expected = ivfc_image_ + ivfc_.level[level - 1].offset + hash_pos;
+	}
+
+	u8 hash[Crypto::kSha256HashLen];
+	Crypto::Sha256(ivfc_image_ + ivfc_.level[level].offset + block * ivfc_.level[level].block_size, ivfc_.level[level].block_size, hash);
+	if (memcmp(hash, expected, Crypto::kSha256HashLen) != 0)
+		return 1;
+
+	pthread_mutex_lock(&verify_lock_);
+	is_block_verified_[level][block] = 1;
+	pthread_mutex_unlock(&verify_lock_);
+
+	return 0;
+}
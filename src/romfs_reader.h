@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <pthread.h>
+#include "types.h"
+#include "oschar.h"
+#include "MappedFile.h"
+#include "romfs.h"
+#include "ivfc.h"
+
+// read-only access to a romfs image, file data is served straight from a mapping of the image
+class RomfsReader
+{
+public:
+	RomfsReader();
+	~RomfsReader();
+
+	// open a raw romfs, an ivfc romfs image, or the romfs of a cxi/cfa or 3dsx
+	int Open(const char* path);
+
+	// look up a "/" separated UTF-8 path with the romfs hash tables, returns non-zero if it doesn't exist
+	int FindDir(const char* path, u32& dir) const;
+	int FindFile(const char* path, u32& file) const;
+
+	// entries are addressed by their offset in the dir and file entry tables, the root is dir 0.
+	// these return NULL if the entry is outside of the tables
+	const struct Romfs::sRomfsDirEntry* GetDir(u32 dir) const;
+	const struct Romfs::sRomfsFileEntry* GetFile(u32 file) const;
+	// file data in the mapping, NULL if it is outside of the romfs
+	const u8* GetFileData(u32 file) const;
+	// position of file data in the image file, only valid if GetFileData isn't NULL
+	inline u64 GetFileDataPos(u32 file) const { return GetFileData(file) - image_.data(); }
+#ifndef _WIN32
+	inline int image_fd() const { return image_.fd(); }
+#endif
+
+	// newly allocated name of an entry, NULL if it isn't safe to use as a path component
+	oschar_t* GetDirName(u32 dir) const;
+	oschar_t* GetFileName(u32 file) const;
+
+	// check reads against the ivfc hash tree, each block is hashed the first time it is read.
+	// the romfs metadata is checked straight away, returns non-zero if there's no hash tree or the metadata doesn't match it
+	int EnableVerification();
+	inline bool is_verifying() const { return is_verifying_; }
+	// returns non-zero if any of size bytes of file data from offset doesn't match the hash tree, always 0 without verification.
+	// safe to call from several threads
+	int VerifyFileData(u32 file, u64 offset, u64 size);
+private:
+	MappedFile image_;
+
+	// the ivfc image the romfs is level2 of, NULL if there's no hash tree
+	const u8* ivfc_image_;
+	u64 ivfc_image_size_;
+	struct Ivfc::sImageGeometry ivfc_;
+	bool is_verifying_;
+	// one flag per block of each level, set once the block matched its hash
+	std::vector<u8> is_block_verified_[Ivfc::kLevelNum];
+	pthread_mutex_t verify_lock_;
+
+	const u8* romfs_;
+	u64 romfs_size_;
+	u64 data_offset_;
+
+	const u32* dir_hash_table_;
+	u32 dir_hash_num_;
+	const u8* dir_table_;
+	u32 dir_table_size_;
+
+	const u32* file_hash_table_;
+	u32 file_hash_num_;
+	const u8* file_table_;
+	u32 file_table_size_;
+
+	int FindRomfs();
+	int SetRomfs(const u8* romfs, u64 size);
+
+	int FindEntry(const char* path, bool is_file, u32& entry) const;
+	int LookupEntry(u32 parent, const utf16char_t* name, bool is_file, u32& entry) const;
+	bool IsSameName(const u8* name, u32 name_size, const utf16char_t* other) const;
+	oschar_t* CopyName(const u8* name, u32 name_size) const;
+
+	// verify the level2 blocks holding size bytes from pos in the romfs
+	int VerifyRomfs(u64 pos, u64 size);
+	// verify a block, after the block of the level above holding its hash
+	int VerifyBlock(int level, u64 block);
+};
@@ -0,0 +1,193 @@
+#define FUSE_USE_VERSION 26
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fuse.h>
+#include "types.h"
+#include "oschar.h"
+#include "romfs_reader.h"
+
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+static const u32 kMaxEntryNum = 0x1000000;
+
+// read-only fuse filesystem over a romfs image.
+// lookups go through the romfs hash tables, and reads hand fuse a range of the image file, so the kernel copies file data straight from the page cache
+static inline RomfsReader* GetReader()
+{
+	return (RomfsReader*)fuse_get_context()->private_data;
+}
+
+static int RomfsGetattr(const char* path, struct stat* st)
+{
+	RomfsReader* reader = GetReader();
+	u32 entry;
+
+	memset(st, 0, sizeof(struct stat));
+	if (reader->FindFile(path, entry) == 0)
+	{
+		st->st_mode = S_IFREG | 0444;
+		st->st_nlink = 1;
+		st->st_size = le_dword(reader->GetFile(entry)->data_size);
+	}
+	else if (reader->FindDir(path, entry) == 0)
+	{
+		st->st_mode = S_IFDIR | 0555;
+		st->st_nlink = 2;
+	}
+	else
+	{
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static int RomfsReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi)
+{
+	RomfsReader* reader = GetReader();
+	u32 dir;
+
+	if (reader->FindDir(path, dir) != 0)
+		return -ENOENT;
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+
+	// the sibling chains are bounded by the table sizes, a corrupt romfs could loop forever
+	const struct Romfs::sRomfsDirEntry* dir_entry = reader->GetDir(dir);
+	u32 entry_num = 0;
+	for (u32 child = le_word(dir_entry->child_offset); child != Romfs::kUnusedOffset && entry_num < kMaxEntryNum; child = le_word(reader->GetDir(child)->sibling_offset), entry_num++)
+	{
+		oschar_t* name = reader->GetDirName(child);
+		if (name == NULL)
+			return -EIO;
+		filler(buf, name, NULL, 0);
+		free(name);
+	}
+
+	for (u32 file = le_word(dir_entry->file_offset); file != Romfs::kUnusedOffset && entry_num < kMaxEntryNum; file = le_word(reader->GetFile(file)->sibling_offset), entry_num++)
+	{
+		oschar_t* name = reader->GetFileName(file);
+		if (name == NULL)
+			return -EIO;
+		filler(buf, name, NULL, 0);
+		free(name);
+	}
+
+	return 0;
+}
+
+static int RomfsOpen(const char* path, struct fuse_file_info* fi)
+{
+	RomfsReader* reader = GetReader();
+	u32 file;
+
+	if (reader->FindFile(path, file) != 0)
+		return -ENOENT;
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EROFS;
+	if (reader->GetFileData(file) == NULL)
+		return -EIO;
+
+	// the file entry offset saves looking the path up again on every read
+	fi->fh = file;
+	fi->keep_cache = 1;
+
+	return 0;
+}
+
+static int RomfsReadBuf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi)
+{
+	RomfsReader* reader = GetReader();
+	u32 file = fi->fh;
+	u64 file_size = le_dword(reader->GetFile(file)->data_size);
+
+	if (offset < 0)
+		return -EINVAL;
+	if ((u64)offset >= file_size)
+		size = 0;
+	else if (size > file_size - offset)
+		size = file_size - offset;
+
+	// blocks are hashed the first time they are read
+	if (reader->VerifyFileData(file, offset, size) != 0)
+	{
+		fprintf(stderr, "[ERROR] File data doesn't match the IVFC hash tree: %s\n", path);
+		return -EIO;
+	}
+
+	struct fuse_bufvec* buf = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec));
+	if (buf == NULL)
+		return -ENOMEM;
+
+	// fuse frees any memory it is handed, so the data is described as a position in the image instead of a pointer into the mapping
+	*buf = FUSE_BUFVEC_INIT(size);
+	buf->buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+	buf->buf[0].fd = reader->image_fd();
+	buf->buf[0].pos = reader->GetFileDataPos(file) + offset;
+	*bufp = buf;
+
+	return 0;
+}
+
+int usage(const char *prog_name)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"    %s image mountpoint [options] [fuse options]\n\n"
+		"The image is a RomFS, an IVFC RomFS image, a CXI/CFA or a 3DSX.\n\n"
+		"Options:\n"
+		"    --verify=on|off    : Check file data against the IVFC hash tree of a CXI/CFA or IVFC image (default off)\n"
+		, prog_name);
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<char*> fuse_argv;
+	const char* image_file;
+	bool verify = false;
+	RomfsReader reader;
+	struct fuse_operations ops;
+
+	if (argc < 3 || argv[1][0] == '-')
+	{
+		return usage(argv[0]);
+	}
+	image_file = argv[1];
+
+	// our own options are taken out, the mountpoint and everything else is for fuse
+	fuse_argv.push_back(argv[0]);
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--verify=on") == 0 || strcmp(argv[i], "--verify=off") == 0)
+		{
+			verify = strcmp(argv[i], "--verify=on") == 0;
+		}
+		else
+		{
+			fuse_argv.push_back(argv[i]);
+		}
+	}
+
+	safe_call(reader.Open(image_file));
+	if (verify)
+	{
+		safe_call(reader.EnableVerification());
+	}
+
+	memset(&ops, 0, sizeof(struct fuse_operations));
+	ops.getattr = RomfsGetattr;
+	ops.readdir = RomfsReaddir;
+	ops.open = RomfsOpen;
+	ops.read_buf = RomfsReadBuf;
+
+	fuse_argv.push_back(NULL);
+	return fuse_main(fuse_argv.size() - 1, &fuse_argv[0], &ops, &reader);
+}
@@ -0,0 +1,412 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <set>
+#include "types.h"
+#include "oschar.h"
+#include "romfs_reader.h"
+#include "thread_pool.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+#ifdef WIN32
+static inline char* FixMinGWPath(char* buf)
+{
+	if (*buf == '/')
+	{
+		buf[0] = buf[1];
+		buf[1] = ':';
+	}
+	return buf;
+}
+#else
+#define FixMinGWPath(_arg) (_arg)
+#endif
+
+struct sArgInfo
+{
+	const char* command;
+	const char* image_file;
+	const char* out_dir;
+	// path inside the romfs, the root if not set
+	const char* romfs_path;
+	int thread_num;
+	// check file data against the ivfc hash tree
+	bool verify;
+};
+
+class RomfsTool
+{
+public:
+	RomfsTool()
+	{
+
+	}
+
+	~RomfsTool()
+	{
+		for (size_t i = 0; i < entry_.size(); i++)
+		{
+			free(entry_[i].path);
+		}
+	}
+
+	int Run(const struct sArgInfo& args)
+	{
+		safe_call(reader_.Open(args.image_file));
+		if (args.verify)
+		{
+			safe_call(reader_.EnableVerification());
+		}
+
+		if (strcmp(args.command, "list") == 0)
+		{
+			return List(args);
+		}
+
+		return Extract(args);
+	}
+
+private:
+	struct sEntry
+	{
+		oschar_t* path;
+		bool is_dir;
+		u32 offset;
+	};
+
+	RomfsReader reader_;
+	std::vector<struct sEntry> entry_;
+	// the files in entry_, which are extracted in parallel
+	std::vector<const struct sEntry*> file_;
+	ThreadPool pool_;
+
+	int List(const struct sArgInfo& args)
+	{
+		static const oschar_t kRootPath[1] = { '\0' };
+		u32 file, dir;
+
+		// a single file is found through the hash tables
+		if (args.romfs_path != NULL && reader_.FindFile(args.romfs_path, file) == 0)
+		{
+			printf("%12" PRIu64 "  %s\n", le_dword(reader_.GetFile(file)->data_size), args.romfs_path);
+			return 0;
+		}
+
+		if (reader_.FindDir(args.romfs_path != NULL ? args.romfs_path : "", dir) != 0)
+		{
+			fprintf(stderr, "[ERROR] Not found in romfs: %s\n\n", args.romfs_path);
+			return 1;
+		}
+
+		safe_call(AddDirEntries(dir, kRootPath));
+		for (size_t i = 0; i < entry_.size(); i++)
+		{
+			if (entry_[i].is_dir)
+			{
+				printf("%12s  ", "<dir>");
+			}
+			else
+			{
+				printf("%12" PRIu64 "  ", le_dword(reader_.GetFile(entry_[i].offset)->data_size));
+			}
+			os_fputs(entry_[i].path, stdout);
+			putchar('\n');
+		}
+
+		return 0;
+	}
+
+	int Extract(const struct sArgInfo& args)
+	{
+		oschar_t* out_dir = os_CopyConvertCharStr(args.out_dir);
+		u32 file, dir;
+		int ret = 0;
+
+		os_makedir(out_dir);
+
+		// a single file is found through the hash tables, and written into out_dir
+		if (args.romfs_path != NULL && reader_.FindFile(args.romfs_path, file) == 0)
+		{
+			oschar_t* name = reader_.GetFileName(file);
+			if (name == NULL)
+			{
+				free(out_dir);
+				die("[ERROR] File name can't be extracted.");
+			}
+
+			struct sEntry entry;
+			entry.path = os_AppendToPath(out_dir, name);
+			entry.is_dir = false;
+			entry.offset = file;
+			entry_.push_back(entry);
+			free(name);
+		}
+		else if (reader_.FindDir(args.romfs_path != NULL ? args.romfs_path : "", dir) == 0)
+		{
+			ret = AddDirEntries(dir, out_dir);
+		}
+		else
+		{
+			fprintf(stderr, "[ERROR] Not found in romfs: %s\n\n", args.romfs_path);
+			ret = 1;
+		}
+		free(out_dir);
+		safe_call(ret);
+
+		// directories are created in order, before any of their files
+		u64 size = 0;
+		for (size_t i = 0; i < entry_.size(); i++)
+		{
+			if (entry_[i].is_dir)
+			{
+				os_makedir(entry_[i].path);
+			}
+			else
+			{
+				file_.push_back(&entry_[i]);
+				size += le_dword(reader_.GetFile(entry_[i].offset)->data_size);
+			}
+		}
+
+		pool_.SetThreadNum(args.thread_num);
+		safe_call(pool_.Run(ExtractFileTask, this, file_.size()));
+
+		printf("Extracted %u files, %" PRIu64 " bytes\n", (u32)file_.size(), size);
+
+		return 0;
+	}
+
+	static int ExtractFileTask(void* arg, size_t index)
+	{
+		RomfsTool* tool = (RomfsTool*)arg;
+
+		return tool->ExtractFile(*tool->file_[index]);
+	}
+
+	int ExtractFile(const struct sEntry& entry)
+	{
+		const u8* data = reader_.GetFileData(entry.offset);
+		u64 size = le_dword(reader_.GetFile(entry.offset)->data_size);
+		FILE* fp;
+
+		if (data == NULL)
+		{
+			fprintf(stderr, "[ERROR] File data is outside of the romfs: ");
+			os_fputs(entry.path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+
+		if (reader_.VerifyFileData(entry.offset, 0, size) != 0)
+		{
+			fprintf(stderr, "[ERROR] File data doesn't match the IVFC hash tree: ");
+			os_fputs(entry.path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+
+		if ((fp = os_fopen(entry.path, OS_MODE_WRITE)) == NULL)
+		{
+			fprintf(stderr, "[ERROR] Failed to create file: ");
+			os_fputs(entry.path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+
+		if (fwrite(data, 1, size, fp) != size)
+		{
+			fclose(fp);
+			fprintf(stderr, "[ERROR] Failed to write file: ");
+			os_fputs(entry.path, stderr);
+			fputs("\n", stderr);
+			return 1;
+		}
+		fclose(fp);
+
+		return 0;
+	}
+
+	// a directory being walked, and the next of its subdirectories to add
+	struct sDirWalk
+	{
+		const oschar_t* path;
+		u32 child;
+	};
+
+	// add the files and subdirectories under dir, with path being where dir is.
+	// every directory is listed before what is in it, the tree is walked without recursion and
+	// each directory is only entered once, so a corrupt romfs whose directories loop back is rejected
+	int AddDirEntries(u32 dir, const oschar_t* path)
+	{
+		std::set<u32> visited;
+		std::vector<struct sDirWalk> walk;
+
+		const struct Romfs::sRomfsDirEntry* dir_entry = reader_.GetDir(dir);
+		if (dir_entry == NULL) die("[ERROR] Directory is outside of the romfs.");
+
+		safe_call(AddFileEntries(dir_entry, path));
+		visited.insert(dir);
+
+		struct sDirWalk root;
+		root.path = path;
+		root.child = le_word(dir_entry->child_offset);
+		walk.push_back(root);
+
+		while (!walk.empty())
+		{
+			u32 child = walk.back().child;
+			if (child == Romfs::kUnusedOffset)
+			{
+				walk.pop_back();
+				continue;
+			}
+
+			const struct Romfs::sRomfsDirEntry* child_entry = reader_.GetDir(child);
+			oschar_t* name = reader_.GetDirName(child);
+			if (name == NULL) die("[ERROR] Romfs directory entry is invalid.");
+			if (!visited.insert(child).second)
+			{
+				free(name);
+				die("[ERROR] Romfs directories loop back on themselves.");
+			}
+			walk.back().child = le_word(child_entry->sibling_offset);
+
+			struct sEntry entry;
+			entry.path = os_AppendToPath(walk.back().path, name);
+			entry.is_dir = true;
+			entry.offset = child;
+			entry_.push_back(entry);
+			free(name);
+
+			safe_call(AddFileEntries(child_entry, entry.path));
+
+			struct sDirWalk next;
+			next.path = entry.path;
+			next.child = le_word(child_entry->child_offset);
+			walk.push_back(next);
+		}
+
+		return 0;
+	}
+
+	// add the files directly in dir_entry
+	int AddFileEntries(const struct Romfs::sRomfsDirEntry* dir_entry, const oschar_t* path)
+	{
+		for (u32 file = le_word(dir_entry->file_offset); file != Romfs::kUnusedOffset; file = le_word(reader_.GetFile(file)->sibling_offset))
+		{
+			oschar_t* name = reader_.GetFileName(file);
+			if (name == NULL) die("[ERROR] Romfs file entry is invalid.");
+			// the file table can't hold more entries than this, so a file sibling chain that loops is caught here
+			if (entry_.size() > kMaxEntryNum)
+			{
+				free(name);
+				die("[ERROR] Romfs has too many entries.");
+			}
+
+			struct sEntry entry;
+			entry.path = os_AppendToPath(path, name);
+			entry.is_dir = false;
+			entry.offset = file;
+			entry_.push_back(entry);
+			free(name);
+		}
+
+		return 0;
+	}
+
+	static const size_t kMaxEntryNum = 0x1000000;
+};
+
+int usage(const char *prog_name)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"    %s list image [path]\n"
+		"    %s extract image out_dir [path] [options]\n\n"
+		"The image is a RomFS, an IVFC RomFS image, a CXI/CFA or a 3DSX.\n"
+		"path is a file or directory in the RomFS, the root by default.\n\n"
+		"Options:\n"
+		"    --threads=num      : Number of threads, 0 uses every cpu core (default)\n"
+		"    --verify=on|off    : Check file data against the IVFC hash tree of a CXI/CFA or IVFC image (default off)\n"
+		, prog_name, prog_name);
+	return 1;
+}
+
+int ParseArgs(struct sArgInfo& info, int argc, char **argv)
+{
+	std::vector<const char*> input;
+
+	memset((u8*)&info, 0, sizeof(struct sArgInfo));
+
+	char *arg, *value;
+
+	for (int i = 1; i < argc; i++)
+	{
+		arg = argv[i];
+		if (strncmp(arg, "--", 2) != 0)
+		{
+			input.push_back(arg);
+			continue;
+		}
+
+		// skip over "--" to get name of argument
+		arg += 2;
+
+		// get argument value
+		value = strchr(arg, '=');
+
+		// check there is actually an argument value
+		if (value == NULL || value[1] == '\0')
+		{
+			return usage(argv[0]);
+		}
+
+		// skip over "=", overwriting it to null byte
+		*value++ = '\0';
+
+		if (strcmp(arg, "threads") == 0)
+		{
+			info.thread_num = strtol(value, NULL, 0);
+		}
+		else if (strcmp(arg, "verify") == 0 && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0))
+		{
+			info.verify = strcmp(value, "on") == 0;
+		}
+		else
+		{
+			fprintf(stderr, "[ERROR] Unknown argument: %s\n", arg);
+			return usage(argv[0]);
+		}
+	}
+
+	if (input.size() >= 2 && input.size() <= 3 && strcmp(input[0], "list") == 0)
+	{
+		info.image_file = FixMinGWPath((char*)input[1]);
+		info.romfs_path = input.size() == 3 ? input[2] : NULL;
+	}
+	else if (input.size() >= 3 && input.size() <= 4 && strcmp(input[0], "extract") == 0)
+	{
+		info.image_file = FixMinGWPath((char*)input[1]);
+		info.out_dir = FixMinGWPath((char*)input[2]);
+		info.romfs_path = input.size() == 4 ? input[3] : NULL;
+	}
+	else
+	{
+		return usage(argv[0]);
+	}
+	info.command = input[0];
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	struct sArgInfo args;
+	RomfsTool tool;
+
+	safe_call(ParseArgs(args, argc, argv));
+	return tool.Run(args);
+}
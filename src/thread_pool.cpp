@@ -0,0 +1,203 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool() :
+	thread_num_(0),
+	is_stopping_(false),
+	func_(NULL),
+	arg_(NULL),
+	task_num_(0),
+	next_task_(0),
+	result_(0),
+	is_running_(false),
+	run_id_(0),
+	busy_num_(0)
+{
+	pthread_mutex_init(&lock_, NULL);
+	pthread_cond_init(&work_cond_, NULL);
+	pthread_cond_init(&done_cond_, NULL);
+	SetThreadNum(0);
+}
+
+ThreadPool::~ThreadPool()
+{
+	StopWorkers();
+	pthread_cond_destroy(&done_cond_);
+	pthread_cond_destroy(&work_cond_);
+	pthread_mutex_destroy(&lock_);
+}
+
+int ThreadPool::GetCpuNum()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int cpu_num = info.dwNumberOfProcessors;
+#else
+	int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return cpu_num > 0 ? cpu_num : 1;
+}
+
+void ThreadPool::SetThreadNum(int thread_num)
+{
+	thread_num = thread_num > 0 ? thread_num : GetCpuNum();
+
+	// the workers are restarted with the new number on the next Run
+	if (thread_num != thread_num_)
+	{
+		StopWorkers();
+	}
+	thread_num_ = thread_num;
+}
+
+int ThreadPool::Run(TaskFunc func, void* arg, size_t task_num)
+{
+	pthread_mutex_lock(&lock_);
+
+	// the workers are taken, so run everything here
+	if (is_running_ || is_stopping_ || thread_num_ == 1 || task_num <= 1)
+	{
+		pthread_mutex_unlock(&lock_);
+		for (size_t i = 0; i < task_num; i++)
+		{
+			int rc = func(arg, i);
+			if (rc != 0)
+			{
+				return rc;
+			}
+		}
+		return 0;
+	}
+
+	if (worker_.empty())
+	{
+		StartWorkers();
+	}
+
+	func_ = func;
+	arg_ = arg;
+	task_num_ = task_num;
+	next_task_ = 0;
+	result_ = 0;
+	is_running_ = true;
+	run_id_++;
+	pthread_cond_broadcast(&work_cond_);
+
+	RunTasks();
+
+	// wait for the workers still running a task
+	while (busy_num_ > 0)
+	{
+		pthread_cond_wait(&done_cond_, &lock_);
+	}
+
+	int result = result_;
+	is_running_ = false;
+	func_ = NULL;
+	arg_ = NULL;
+	task_num_ = 0;
+	next_task_ = 0;
+	pthread_mutex_unlock(&lock_);
+
+	return result;
+}
+
+void* ThreadPool::WorkerThread(void* param)
+{
+	ThreadPool* pool = (ThreadPool*)param;
+	u32 run_id = 0;
+
+	pthread_mutex_lock(&pool->lock_);
+	while (true)
+	{
+		while (!pool->is_stopping_ && (!pool->is_running_ || pool->run_id_ == run_id))
+		{
+			pthread_cond_wait(&pool->work_cond_, &pool->lock_);
+		}
+
+		if (pool->is_stopping_)
+		{
+			break;
+		}
+
+		run_id = pool->run_id_;
+		pool->RunTasks();
+	}
+	pthread_mutex_unlock(&pool->lock_);
+
+	return NULL;
+}
+
+void ThreadPool::StartWorkers()
+{
+	for (int i = 1; i < thread_num_; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, WorkerThread, this) != 0)
+		{
+			// the tasks still run, just on fewer threads
+			break;
+		}
+		worker_.push_back(thread);
+	}
+}
+
+void ThreadPool::StopWorkers()
+{
+	if (worker_.empty())
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&lock_);
+	is_stopping_ = true;
+	pthread_cond_broadcast(&work_cond_);
+	pthread_mutex_unlock(&lock_);
+
+	for (size_t i = 0; i < worker_.size(); i++)
+	{
+		pthread_join(worker_[i], NULL);
+	}
+	worker_.clear();
+
+	pthread_mutex_lock(&lock_);
+	is_stopping_ = false;
+	pthread_mutex_unlock(&lock_);
+}
+
+void ThreadPool::RunTasks()
+{
+	TaskFunc func = func_;
+	void* arg = arg_;
+
+	busy_num_++;
+	while (next_task_ < task_num_)
+	{
+		size_t index = next_task_++;
+
+		pthread_mutex_unlock(&lock_);
+		int rc = func(arg, index);
+		pthread_mutex_lock(&lock_);
+
+		if (rc != 0)
+		{
+			// record the first failure and stop handing out tasks
+			if (result_ == 0)
+			{
+				result_ = rc;
+			}
+			next_task_ = task_num_;
+		}
+	}
+	busy_num_--;
+
+	if (busy_num_ == 0)
+	{
+		pthread_cond_broadcast(&done_cond_);
+	}
+}
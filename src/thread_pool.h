@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <pthread.h>
+#include "types.h"
+
+class ThreadPool
+{
+public:
+	// task callback, index is the number of the task being run
+	typedef int (*TaskFunc)(void* arg, size_t index);
+
+	ThreadPool();
+	~ThreadPool();
+
+	// number of online cpu cores
+	static int GetCpuNum();
+
+	// a thread_num of 0 or less selects one thread per cpu core
+	void SetThreadNum(int thread_num);
+	inline int thread_num() const { return thread_num_; }
+
+	// run func(arg, i) for every i in [0, task_num) across the worker threads
+	// blocks until all tasks are finished, and returns the first non-zero task result.
+	// a Run from inside a task, or from another thread while one is in progress, runs its tasks on the calling thread
+	int Run(TaskFunc func, void* arg, size_t task_num);
+private:
+	int thread_num_;
+
+	// the workers are started on the first Run and wait for the next one until the pool is destroyed.
+	// the calling thread also runs tasks, so there is one worker less than thread_num_
+	std::vector<pthread_t> worker_;
+	pthread_mutex_t lock_;
+	pthread_cond_t work_cond_;
+	pthread_cond_t done_cond_;
+	bool is_stopping_;
+
+	// the current run, guarded by lock_
+	TaskFunc func_;
+	void* arg_;
+	size_t task_num_;
+	size_t next_task_;
+	int result_;
+	bool is_running_;
+	u32 run_id_;
+	size_t busy_num_;
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	static void* WorkerThread(void* param);
+	void StartWorkers();
+	void StopWorkers();
+	// run tasks of the current run until there are none left, called with lock_ held
+	void RunTasks();
+};
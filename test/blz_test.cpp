@@ -0,0 +1,161 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "types.h"
+#include "ByteBuffer.h"
+#include "blz.h"
+#include "test_util.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+// compress and decompress data that is hard, easy and impossible to compress,
+// with sizes that end inside, and exactly on, the segments parsed in parallel
+
+enum DataKind
+{
+	DATA_RANDOM,
+	DATA_ZERO,
+	// runs repeated from up to 0x1100 bytes back, broken up by random bytes, like code
+	DATA_MIXED
+};
+
+static void FillData(std::vector<u8>& data, DataKind kind)
+{
+	size_t distance = 0;
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		if (kind == DATA_ZERO)
+		{
+			data[i] = 0;
+		}
+		else if (kind == DATA_RANDOM || distance == 0 || Random() % 24 == 0)
+		{
+			data[i] = Random() & 0xFF;
+			if (i >= 0x20)
+				distance = 1 + Random() % (i < 0x1100 ? i : 0x1100);
+		}
+		else
+		{
+			data[i] = data[i - distance];
+		}
+	}
+}
+
+static int RoundTrip(const std::vector<u8>& data, bool is_compressible, const char* name)
+{
+	Blz blz;
+	ByteBuffer out;
+	const u8* in = data.empty() ? NULL : &data[0];
+
+	blz.SetThreadNum(4);
+	if (blz.Compress(in, data.size()) != 0)
+	{
+		fprintf(stderr, "[ERROR] Compressing %s data of 0x%x bytes failed.\n\n", name, (u32)data.size());
+		return 1;
+	}
+
+	if (!blz.is_compressed() && is_compressible)
+	{
+		fprintf(stderr, "[ERROR] %s data of 0x%x bytes wasn't compressed.\n\n", name, (u32)data.size());
+		return 1;
+	}
+	if (!blz.is_compressed())
+	{
+		// stored as it is
+		if (blz.data_size() != data.size() || (data.size() && memcmp(blz.data_blob(), in, data.size()) != 0))
+		{
+			fprintf(stderr, "[ERROR] Uncompressed %s data of 0x%x bytes isn't a copy of the input.\n\n", name, (u32)data.size());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (blz.data_size() >= data.size() || Blz::Decompress(blz.data_blob(), blz.data_size(), out) != 0 || out.size() != data.size() || memcmp(out.data_const(), in, data.size()) != 0)
+	{
+		fprintf(stderr, "[ERROR] %s data of 0x%x bytes doesn't round-trip.\n\n", name, (u32)data.size());
+		return 1;
+	}
+
+	return 0;
+}
+
+static int TestRoundTrip()
+{
+	static const char* kName[] = { "random", "zero", "mixed" };
+	static const u32 kSize[] =
+	{
+		0, 1, 2, 3, 8, 9, 0x10, 0x13, 0x1000, 0x1003,
+		Blz::kSegmentSize - 1, Blz::kSegmentSize, Blz::kSegmentSize + 1,
+		2 * Blz::kSegmentSize + 0x1235, 3 * Blz::kSegmentSize
+	};
+
+	for (int kind = DATA_RANDOM; kind <= DATA_MIXED; kind++)
+	{
+		for (size_t i = 0; i < sizeof(kSize) / sizeof(kSize[0]); i++)
+		{
+			std::vector<u8> data(kSize[i]);
+			FillData(data, (DataKind)kind);
+			safe_call(RoundTrip(data, kind != DATA_RANDOM && data.size() >= 0x1000, kName[kind]));
+		}
+	}
+
+	// the output doesn't depend on how many threads parsed it
+	std::vector<u8> data(2 * Blz::kSegmentSize + 0x777);
+	FillData(data, DATA_MIXED);
+	Blz single;
+	Blz multi;
+	single.SetThreadNum(1);
+	multi.SetThreadNum(3);
+	safe_call(single.Compress(&data[0], data.size()));
+	safe_call(multi.Compress(&data[0], data.size()));
+	if (!single.is_compressed() || single.data_size() != multi.data_size() || memcmp(single.data_blob(), multi.data_blob(), single.data_size()) != 0) die("[ERROR] Compressed data depends on the thread count.");
+
+	printf("BLZ round trip: ok\n");
+
+	return 0;
+}
+
+static int TestCorrupt()
+{
+	std::vector<u8> data(0x4000);
+	FillData(data, DATA_MIXED);
+
+	Blz blz;
+	safe_call(blz.Compress(&data[0], data.size()));
+	if (!blz.is_compressed()) die("[ERROR] Test data didn't compress.");
+
+	// damaged data must be rejected or decompress to something, never read or write out of bounds
+	std::vector<u8> damaged(blz.data_blob(), blz.data_blob() + blz.data_size());
+	for (int i = 0; i < 500; i++)
+	{
+		std::vector<u8> copy(damaged);
+		ByteBuffer out;
+
+		for (int j = 0; j < 4; j++)
+		{
+			// the end holds the footer and the first control bytes
+			size_t pos = (j & 1) ? copy.size() - 1 - Random() % 0x20 : Random() % copy.size();
+			copy[pos] ^= 1 << (Random() % 8);
+		}
+		Blz::Decompress(&copy[0], copy.size(), out);
+	}
+
+	ByteBuffer out;
+	if (Blz::Decompress(&damaged[0], 7, out) == 0) die("[ERROR] Data smaller than the footer was accepted.");
+
+	printf("BLZ damaged data: ok\n");
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	SeedRandom(0x2545F491);
+
+	safe_call(TestRoundTrip());
+	safe_call(TestCorrupt());
+
+	return 0;
+}
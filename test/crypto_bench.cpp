@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+#include "types.h"
+#include "crypto.h"
+#include "crypto_aes.h"
+#include "crypto_sha256.h"
+#include "ivfc.h"
+#include "thread_pool.h"
+#include "polarssl/aes.h"
+#include "polarssl/sha2.h"
+#include "polarssl/bignum.h"
+
+// throughput of the hashing, aes and rsa paths, next to the polarssl code they replace where it is still around.
+// built by make check, but not run by it
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void Report(const char* name, u64 size, double seconds)
+{
+	printf("%-32s %10.1f MB/s\n", name, size / seconds / 1000000.0);
+}
+
+static void BenchSha256(const std::vector<u8>& data)
+{
+	u8 hash[Crypto::kSha256HashLen];
+	std::vector<u8> hashes(data.size() / Ivfc::kBlockSize * Crypto::kSha256HashLen);
+	double start;
+
+	start = Now();
+	sha2(&data[0], data.size(), hash, 0);
+	Report("sha-256 polarssl", data.size(), Now() - start);
+
+	start = Now();
+	Crypto::Sha256(&data[0], data.size(), hash);
+	Report("sha-256", data.size(), Now() - start);
+
+	start = Now();
+	for (size_t i = 0; i < data.size() / Ivfc::kBlockSize; i++)
+	{
+		Crypto::Sha256(&data[i * Ivfc::kBlockSize], Ivfc::kBlockSize, &hashes[i * Crypto::kSha256HashLen]);
+	}
+	Report("sha-256 4 KiB blocks", data.size(), Now() - start);
+
+	start = Now();
+	Crypto::Sha256Blocks(&data[0], Ivfc::kBlockSize, data.size() / Ivfc::kBlockSize, &hashes[0]);
+	Report("sha-256 4 KiB blocks, batched", data.size(), Now() - start);
+}
+
+static void BenchIvfc(const std::vector<u8>& data)
+{
+	int cpu_num = ThreadPool::GetCpuNum();
+	char name[64];
+
+	for (int thread_num = 1; ; thread_num *= 2)
+	{
+		if (thread_num > cpu_num)
+			thread_num = cpu_num;
+
+		Ivfc ivfc;
+		ivfc.SetThreadNum(thread_num);
+		double start = Now();
+		ivfc.CreateIvfcHashTree(&data[0], data.size());
+		snprintf(name, sizeof(name), "ivfc hash tree, %d thread%s", thread_num, thread_num > 1 ? "s" : "");
+		Report(name, data.size(), Now() - start);
+
+		if (thread_num == cpu_num)
+			break;
+	}
+}
+
+static void BenchAes(const std::vector<u8>& data)
+{
+	static const u8 kKey[Crypto::kAes128KeySize] = { 0 };
+	std::vector<u8> out(data.size());
+	u8 ctr[Crypto::kAesBlockSize] = { 0 };
+	u8 stream_block[Crypto::kAesBlockSize];
+	size_t nc_off = 0;
+	aes_context ctx;
+	double start;
+
+	// polarssl expands the key on every call in the old code, that is left out here
+	aes_setkey_enc(&ctx, kKey, 128);
+	start = Now();
+	aes_crypt_ctr(&ctx, data.size(), &nc_off, ctr, stream_block, &data[0], &out[0]);
+	Report("aes-ctr polarssl", data.size(), Now() - start);
+
+	start = Now();
+	Crypto::AesCtr(&data[0], data.size(), kKey, ctr, &out[0]);
+	Report("aes-ctr", data.size(), Now() - start);
+
+	start = Now();
+	aes_crypt_cbc(&ctx, AES_ENCRYPT, data.size(), ctr, &data[0], &out[0]);
+	Report("aes-cbc encrypt polarssl", data.size(), Now() - start);
+
+	start = Now();
+	Crypto::AesCbcEncrypt(&data[0], data.size(), kKey, ctr, &out[0]);
+	Report("aes-cbc encrypt", data.size(), Now() - start);
+
+	aes_setkey_dec(&ctx, kKey, 128);
+	start = Now();
+	aes_crypt_cbc(&ctx, AES_DECRYPT, data.size(), ctr, &data[0], &out[0]);
+	Report("aes-cbc decrypt polarssl", data.size(), Now() - start);
+
+	start = Now();
+	Crypto::AesCbcDecrypt(&data[0], data.size(), kKey, ctr, &out[0]);
+	Report("aes-cbc decrypt", data.size(), Now() - start);
+}
+
+static void BenchModExp(size_t bits)
+{
+	std::vector<u8> buf(bits / 8);
+	mpi A, E, N, X, RR;
+	char name[64];
+
+	mpi_init(&A); mpi_init(&E); mpi_init(&N); mpi_init(&X); mpi_init(&RR);
+
+	for (size_t i = 0; i < buf.size(); i++)
+	{
+		buf[i] = (u8)(i * 0x9D + 0x35);
+	}
+	buf[0] |= 0x80;
+	buf[buf.size() - 1] |= 1;
+	mpi_read_binary(&N, &buf[0], buf.size());
+	buf[0] &= 0x7F;
+	mpi_read_binary(&A, &buf[0], buf.size());
+
+	// a public exponent, and one as long as the modulus like a private key without the crt
+	for (int is_private = 0; is_private < 2; is_private++)
+	{
+		if (is_private)
+			mpi_read_binary(&E, &buf[0], buf.size());
+		else
+			mpi_lset(&E, 65537);
+
+		int op_num = 0;
+		double start = Now();
+		double seconds;
+		do
+		{
+			mpi_exp_mod(&X, &A, &E, &N, &RR);
+			op_num++;
+		} while ((seconds = Now() - start) < 1.0);
+
+		snprintf(name, sizeof(name), "rsa-%u %s exponent", (u32)bits, is_private ? "private" : "public");
+		printf("%-32s %10.1f ops/s\n", name, op_num / seconds);
+	}
+
+	mpi_free(&A); mpi_free(&E); mpi_free(&N); mpi_free(&X); mpi_free(&RR);
+}
+
+int main(int argc, char** argv)
+{
+	// size of the data hashed and encrypted, in MiB
+	u32 size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 64;
+	if (size == 0)
+	{
+		fprintf(stderr, "Usage:\n    %s [size in MiB]\n\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<u8> data(size * 0x100000);
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = (u8)(i * 0x3B + (i >> 12));
+	}
+
+	printf("sha-256 backend: %s, aes backend: %s\n", CryptoSha256::backend_name(), CryptoAes::backend_name());
+	BenchSha256(data);
+	BenchIvfc(data);
+	BenchAes(data);
+	BenchModExp(2048);
+	BenchModExp(4096);
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "types.h"
+#include "crypto.h"
+#include "crypto_aes.h"
+#include "crypto_sha256.h"
+#include "polarssl/aes.h"
+#include "polarssl/sha2.h"
+#include "polarssl/bignum.h"
+#include "test_util.h"
+
+#define die(msg) do { fputs(msg "\n\n", stderr); return 1; } while(0)
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+// the accelerated backends and the montgomery kernels are checked against the portable polarssl code
+
+static void RandomFill(u8* data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		data[i] = Random() & 0xFF;
+	}
+}
+
+static int TestSha256()
+{
+	if (CryptoSha256::SelfTest(CryptoSha256::BACKEND_PORTABLE) != 0) die("[ERROR] SHA-256 portable self-test failed.");
+	if (CryptoSha256::SelfTest(CryptoSha256::backend()) != 0) die("[ERROR] SHA-256 self-test failed.");
+
+	std::vector<u8> data(0x4000 + 0x41);
+	RandomFill(&data[0], data.size());
+	u8 hash[Crypto::kSha256HashLen];
+	u8 reference[Crypto::kSha256HashLen];
+
+	// sizes around the block and padding boundaries, from an unaligned start
+	for (size_t size = 0; size < 0x220; size++)
+	{
+		Crypto::Sha256(&data[1], size, hash);
+		sha2(&data[1], size, reference, 0);
+		if (memcmp(hash, reference, sizeof(hash)) != 0) die("[ERROR] SHA-256 doesn't match polarssl.");
+	}
+
+	// incremental hashing in uneven pieces
+	for (int i = 0; i < 16; i++)
+	{
+		struct Crypto::sSha256Context ctx;
+		size_t size = Random() % data.size();
+
+		Crypto::Sha256Init(ctx);
+		for (size_t pos = 0; pos < size; )
+		{
+			size_t piece = Random() % 0x90;
+			if (piece > size - pos)
+				piece = size - pos;
+			Crypto::Sha256Update(ctx, &data[pos], piece);
+			pos += piece;
+		}
+		Crypto::Sha256Final(ctx, hash);
+
+		sha2(&data[0], size, reference, 0);
+		if (memcmp(hash, reference, sizeof(hash)) != 0) die("[ERROR] Incremental SHA-256 doesn't match polarssl.");
+	}
+
+	// batches of equally sized blocks, including the ivfc block size and block counts that don't fill every lane
+	static const size_t kBlockSize[] = { 0x1000, 0x40, 0x37, 0x200, 0x3F1 };
+	for (size_t i = 0; i < sizeof(kBlockSize) / sizeof(kBlockSize[0]); i++)
+	{
+		size_t block_num = data.size() / kBlockSize[i];
+		for (size_t num = 1; num <= block_num; num += (num < 2 * CryptoSha256::kLaneNum) ? 1 : 5)
+		{
+			std::vector<u8> hashes(num * Crypto::kSha256HashLen);
+			Crypto::Sha256Blocks(&data[0], kBlockSize[i], num, &hashes[0]);
+			for (size_t j = 0; j < num; j++)
+			{
+				sha2(&data[kBlockSize[i] * j], kBlockSize[i], reference, 0);
+				if (memcmp(&hashes[j * Crypto::kSha256HashLen], reference, sizeof(reference)) != 0) die("[ERROR] Batch SHA-256 doesn't match polarssl.");
+			}
+		}
+	}
+
+	printf("SHA-256 (%s): ok\n", CryptoSha256::backend_name());
+
+	return 0;
+}
+
+static int TestAes()
+{
+	if (CryptoAes::SelfTest(CryptoAes::BACKEND_PORTABLE) != 0) die("[ERROR] AES portable self-test failed.");
+	if (CryptoAes::SelfTest(CryptoAes::backend()) != 0) die("[ERROR] AES self-test failed.");
+
+	std::vector<u8> data(0x1000 + 0x1F);
+	std::vector<u8> result(data.size());
+	std::vector<u8> reference(data.size());
+	RandomFill(&data[0], data.size());
+
+	for (int i = 0; i < 64; i++)
+	{
+		u8 key[Crypto::kAes128KeySize];
+		u8 ctr[Crypto::kAesBlockSize];
+		u8 reference_ctr[Crypto::kAesBlockSize];
+		u8 stream_block[Crypto::kAesBlockSize];
+		size_t nc_off = 0;
+		aes_context ctx;
+
+		// the low counter bytes are often all ones, so the carry crosses the 64-bit halves
+		RandomFill(key, sizeof(key));
+		RandomFill(ctr, sizeof(ctr));
+		if (i & 1)
+			memset(ctr + 4, 0xFF, 12);
+		memcpy(reference_ctr, ctr, sizeof(ctr));
+
+		size_t size = Random() % data.size();
+		Crypto::AesCtr(&data[0], size, key, ctr, &result[0]);
+		aes_setkey_enc(&ctx, key, 128);
+		aes_crypt_ctr(&ctx, size, &nc_off, reference_ctr, stream_block, &data[0], &reference[0]);
+		if (memcmp(&result[0], &reference[0], size) != 0) die("[ERROR] AES-CTR doesn't match polarssl.");
+
+		u8 iv[Crypto::kAesBlockSize];
+		u8 reference_iv[Crypto::kAesBlockSize];
+		size &= ~(size_t)(Crypto::kAesBlockSize - 1);
+
+		RandomFill(iv, sizeof(iv));
+		memcpy(reference_iv, iv, sizeof(iv));
+		Crypto::AesCbcEncrypt(&data[0], size, key, iv, &result[0]);
+		aes_crypt_cbc(&ctx, AES_ENCRYPT, size, reference_iv, &data[0], &reference[0]);
+		if (memcmp(&result[0], &reference[0], size) != 0 || memcmp(iv, reference_iv, sizeof(iv)) != 0) die("[ERROR] AES-CBC encryption doesn't match polarssl.");
+
+		RandomFill(iv, sizeof(iv));
+		memcpy(reference_iv, iv, sizeof(iv));
+		Crypto::AesCbcDecrypt(&data[0], size, key, iv, &result[0]);
+		aes_setkey_dec(&ctx, key, 128);
+		aes_crypt_cbc(&ctx, AES_DECRYPT, size, reference_iv, &data[0], &reference[0]);
+		if (memcmp(&result[0], &reference[0], size) != 0 || memcmp(iv, reference_iv, sizeof(iv)) != 0) die("[ERROR] AES-CBC decryption doesn't match polarssl.");
+
+		// in place, the way content is re-encrypted
+		memcpy(&result[0], &data[0], size);
+		RandomFill(iv, sizeof(iv));
+		memcpy(reference_iv, iv, sizeof(iv));
+		Crypto::AesCbcDecrypt(&result[0], size, key, iv, &result[0]);
+		aes_crypt_cbc(&ctx, AES_DECRYPT, size, reference_iv, &data[0], &reference[0]);
+		if (memcmp(&result[0], &reference[0], size) != 0) die("[ERROR] In place AES-CBC decryption doesn't match polarssl.");
+	}
+
+	printf("AES (%s): ok\n", CryptoAes::backend_name());
+
+	return 0;
+}
+
+static int RandomMpi(mpi* X, size_t bits, bool is_odd)
+{
+	std::vector<u8> buf(bits / 8);
+	RandomFill(&buf[0], buf.size());
+	buf[0] |= 0x80;
+	if (is_odd)
+		buf[buf.size() - 1] |= 1;
+
+	return mpi_read_binary(X, &buf[0], buf.size());
+}
+
+// X = A^E mod N by square and multiply, without montgomery multiplication
+static int ReferenceExpMod(mpi* X, const mpi* A, const mpi* E, const mpi* N)
+{
+	mpi T;
+	mpi_init(&T);
+
+	int rc = mpi_lset(X, 1);
+	for (size_t i = mpi_msb(E); rc == 0 && i > 0; i--)
+	{
+		if ((rc = mpi_mul_mpi(&T, X, X)) == 0 && (rc = mpi_mod_mpi(X, &T, N)) == 0 && mpi_get_bit(E, i - 1))
+		{
+			if ((rc = mpi_mul_mpi(&T, X, A)) == 0)
+				rc = mpi_mod_mpi(X, &T, N);
+		}
+	}
+
+	mpi_free(&T);
+	return rc;
+}
+
+static int TestModExp(size_t bits, size_t exp_bits, int edge)
+{
+	mpi A, E, N, X, R;
+	int rc;
+
+	mpi_init(&A); mpi_init(&E); mpi_init(&N); mpi_init(&X); mpi_init(&R);
+
+	if ((rc = RandomMpi(&N, bits, true)) == 0 && (rc = RandomMpi(&E, exp_bits, false)) == 0)
+	{
+		// 0, 1 and N - 1, otherwise a random base below N
+		if (edge == 1)
+			rc = mpi_lset(&A, 0);
+		else if (edge == 2)
+			rc = mpi_lset(&A, 1);
+		else if (edge == 3)
+			rc = mpi_sub_int(&A, &N, 1);
+		else if ((rc = RandomMpi(&R, bits, false)) == 0)
+			rc = mpi_mod_mpi(&A, &R, &N);
+	}
+	if (rc == 0)
+		rc = mpi_exp_mod(&X, &A, &E, &N, NULL);
+	if (rc == 0)
+		rc = ReferenceExpMod(&R, &A, &E, &N);
+	if (rc == 0 && mpi_cmp_mpi(&X, &R) != 0)
+		rc = 1;
+
+	mpi_free(&A); mpi_free(&E); mpi_free(&N); mpi_free(&X); mpi_free(&R);
+
+	if (rc != 0)
+	{
+		fprintf(stderr, "[ERROR] %u-bit modular exponentiation doesn't match the reference.\n\n", (u32)bits);
+	}
+	return rc;
+}
+
+static int TestMontgomery()
+{
+	// the fixed width kernels cover 1024, 2048 and 4096-bit moduli, 1536 bits takes the generic path
+	static const size_t kModulusBits[] = { 1024, 2048, 4096, 1536 };
+	for (size_t i = 0; i < sizeof(kModulusBits) / sizeof(kModulusBits[0]); i++)
+	{
+		for (int edge = 0; edge < 4; edge++)
+		{
+			safe_call(TestModExp(kModulusBits[i], 17, edge));
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			// exponents long enough for every sliding window size, up to 7 bits over 1791 bits
+			safe_call(TestModExp(kModulusBits[i], 64, 0));
+			safe_call(TestModExp(kModulusBits[i], kModulusBits[i], 0));
+		}
+	}
+
+	printf("Montgomery multiplication: ok\n");
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	SeedRandom(0x12345678);
+
+	safe_call(TestSha256());
+	safe_call(TestAes());
+	safe_call(TestMontgomery());
+
+	return 0;
+}
@@ -0,0 +1,296 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+#include "types.h"
+#include "elf.h"
+#include "reloc_map.h"
+#include "thread_pool.h"
+#include "test_util.h"
+
+// the relocation passes of 3dsxtool over a large synthetic elf: the relocation scan on one thread and with a task per
+// target section, and the run extraction of BuildRelocs a bit at a time from a vector<bool> and a word at a time.
+// built by make check, but not run by it
+
+struct RelocEntry
+{
+	u16 skip, patch;
+};
+
+// a section of the image and the relocations that patch it, in address order like a linker writes them
+struct Section
+{
+	u32 start, end;
+	std::vector<Elf32_Rel> rels;
+};
+
+struct Image
+{
+	u32 baseAddr, topAddr;
+	std::vector<u32> words;
+	std::vector<Section> sects;
+	RelocMap absRelocMap, relRelocMap;
+};
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void Report(const char* name, double seconds)
+{
+	printf("%-40s %10.1f ms\n", name, seconds * 1000.0);
+}
+
+// text, rodata and data, with runs of absolute and relative relocations up to a few words long between unrelocated words
+static void CreateImage(Image& image, u32 size)
+{
+	image.baseAddr = 0x100000;
+	image.topAddr = image.baseAddr + size;
+	image.words.resize(size / 4);
+
+	u32 sectStart[] = { 0, size / 8, size / 8 + size / 16, size / 4 };
+	for (int s = 0; s < 3; s++)
+	{
+		Section sect;
+		sect.start = sectStart[s];
+		sect.end = sectStart[s + 1];
+		image.sects.push_back(sect);
+	}
+
+	for (int s = 0; s < 3; s++)
+	{
+		Section& sect = image.sects[s];
+		for (u32 i = sect.start; i < sect.end; )
+		{
+			for (u32 skip = 1 + Random() % 48; skip > 0 && i < sect.end; skip--, i++)
+			{
+				image.words[i] = Random();
+			}
+
+			for (u32 patch = 1 + Random() % 12; patch > 0 && i < sect.end; patch--, i++)
+			{
+				Elf32_Rel rel;
+				u32 addr = image.baseAddr + i * 4;
+				u32 target = image.baseAddr + (Random() % (size / 4)) * 4;
+				bool isRelative = Random() % 8 == 0;
+
+				rel.r_offset = le_word(addr);
+				rel.r_info = le_word(ELF32_R_INFO(1, isRelative ? R_ARM_REL32 : R_ARM_ABS32));
+				image.words[i] = isRelative ? target - addr : target;
+				sect.rels.push_back(rel);
+			}
+		}
+	}
+
+	image.absRelocMap.Assign(size / 4);
+	image.relRelocMap.Assign(size / 4);
+}
+
+// the map updates and checks of ElfConvert::ScanRelocSection
+static int ScanRelocTarget(Image& image, size_t index)
+{
+	const Section& sect = image.sects[index];
+
+	for (size_t i = 0; i < sect.rels.size(); i++)
+	{
+		u32 relSrcAddr = le_word(sect.rels[i].r_offset);
+		u32 word = (relSrcAddr - image.baseAddr) / 4;
+		u32& relSrc = image.words[word];
+
+		if (relSrcAddr & 3)
+			return 1;
+		if (image.absRelocMap.Test(word) || image.relRelocMap.Test(word))
+			continue;
+
+		if (ELF32_R_TYPE(le_word(sect.rels[i].r_info)) == R_ARM_ABS32)
+		{
+			if (relSrc < image.baseAddr || relSrc > image.topAddr)
+				return 1;
+			relSrc -= image.baseAddr;
+			image.absRelocMap.Set(word);
+		}
+		else
+		{
+			// relative relocations only need patching when they point into another section
+			u32 relSymAddr = relSrc + relSrcAddr;
+			u32 target = (relSymAddr - image.baseAddr) / 4;
+			if (relSymAddr < image.baseAddr || relSymAddr > image.topAddr)
+				return 1;
+			if (target < sect.start || target >= sect.end)
+			{
+				relSrc = relSymAddr - image.baseAddr;
+				image.relRelocMap.Set(word);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int ScanRelocTargetTask(void* arg, size_t index)
+{
+	return ScanRelocTarget(*(Image*)arg, index);
+}
+
+static void AddRelocs(u32 rs, u32 rp, std::vector<RelocEntry>& relocData)
+{
+	RelocEntry reloc;
+
+	for (reloc.skip = 0xFFFF, reloc.patch = 0; rs > 0xFFFF; rs -= 0xFFFF)
+		relocData.push_back(reloc);
+
+	for (reloc.skip = rs, reloc.patch = 0xFFFF; rp > 0xFFFF; rp -= 0xFFFF)
+	{
+		relocData.push_back(reloc);
+		rs = reloc.skip = 0;
+	}
+
+	if (rs || rp)
+	{
+		reloc.skip = rs;
+		reloc.patch = rp;
+		relocData.push_back(reloc);
+	}
+}
+
+// BuildRelocs before the maps were packed into words
+static void BuildBitRelocs(const std::vector<bool>& map, size_t pos, size_t posEnd, std::vector<RelocEntry>& relocData)
+{
+	for (size_t i = pos; i < posEnd;)
+	{
+		u32 rs = 0, rp = 0;
+		while ((i < posEnd) && !map[i]) i ++, rs ++;
+		while ((i < posEnd) && map[i]) i ++, rp ++;
+
+		if (i == posEnd && rs && !rp)
+			break;
+		AddRelocs(rs, rp, relocData);
+	}
+}
+
+static void BuildRelocs(const RelocMap& map, size_t pos, size_t posEnd, std::vector<RelocEntry>& relocData)
+{
+	for (size_t i = pos; i < posEnd;)
+	{
+		u32 rs = 0, rp = 0;
+		rs = map.RunLength(i, posEnd, false), i += rs;
+		rp = map.RunLength(i, posEnd, true), i += rp;
+
+		if (i == posEnd && rs && !rp)
+			break;
+		AddRelocs(rs, rp, relocData);
+	}
+}
+
+static int BenchScan(Image& image)
+{
+	std::vector<u32> words(image.words);
+	int cpu_num = ThreadPool::GetCpuNum();
+	char name[64];
+
+	for (int thread_num = 1; ; thread_num = cpu_num)
+	{
+		ThreadPool pool;
+		pool.SetThreadNum(thread_num);
+		image.words = words;
+		image.absRelocMap.Assign(image.absRelocMap.size());
+		image.relRelocMap.Assign(image.relRelocMap.size());
+
+		double start = Now();
+		if (pool.Run(ScanRelocTargetTask, &image, image.sects.size()) != 0)
+		{
+			fprintf(stderr, "[ERROR] Relocation scan failed.\n\n");
+			return 1;
+		}
+		snprintf(name, sizeof(name), "relocation scan, %d thread%s", thread_num, thread_num > 1 ? "s" : "");
+		Report(name, Now() - start);
+
+		if (thread_num == cpu_num)
+			break;
+	}
+
+	return 0;
+}
+
+static int BenchBuild(const Image& image)
+{
+	const RelocMap* maps[] = { &image.absRelocMap, &image.relRelocMap };
+	std::vector<bool> bitMaps[2];
+	std::vector<RelocEntry> bitRelocs, relocs;
+	double start;
+
+	for (int m = 0; m < 2; m++)
+	{
+		bitMaps[m].resize(maps[m]->size());
+		for (size_t i = 0; i < maps[m]->size(); i++)
+		{
+			bitMaps[m][i] = maps[m]->Test(i);
+		}
+	}
+
+	start = Now();
+	for (size_t s = 0; s < image.sects.size(); s++)
+	{
+		for (int m = 0; m < 2; m++)
+		{
+			BuildBitRelocs(bitMaps[m], image.sects[s].start, image.sects[s].end, bitRelocs);
+		}
+	}
+	Report("relocation runs, vector<bool>", Now() - start);
+
+	start = Now();
+	for (size_t s = 0; s < image.sects.size(); s++)
+	{
+		for (int m = 0; m < 2; m++)
+		{
+			BuildRelocs(*maps[m], image.sects[s].start, image.sects[s].end, relocs);
+		}
+	}
+	Report("relocation runs, RelocMap::RunLength", Now() - start);
+
+	if (bitRelocs.size() != relocs.size())
+	{
+		fprintf(stderr, "[ERROR] The relocation tables differ.\n\n");
+		return 1;
+	}
+	for (size_t i = 0; i < relocs.size(); i++)
+	{
+		if (bitRelocs[i].skip != relocs[i].skip || bitRelocs[i].patch != relocs[i].patch)
+		{
+			fprintf(stderr, "[ERROR] The relocation tables differ.\n\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	// size of the image, in MiB
+	u32 size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 192;
+	if (size == 0 || size > 1024)
+	{
+		fprintf(stderr, "Usage:\n    %s [image size in MiB, up to 1024]\n\n", argv[0]);
+		return 1;
+	}
+
+	Image image;
+	SeedRandom(0x2F6B3A1D);
+	CreateImage(image, size * 0x100000);
+
+	size_t relocNum = 0;
+	for (size_t s = 0; s < image.sects.size(); s++)
+	{
+		relocNum += image.sects[s].rels.size();
+	}
+	printf("%u MiB image, %u relocations in %u sections\n", size, (u32)relocNum, (u32)image.sects.size());
+
+	if (BenchScan(image) != 0 || BenchBuild(image) != 0)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <vector>
+#include "types.h"
+#include "reloc_map.h"
+#include "test_util.h"
+
+#define safe_call(a) do { int rc = a; if(rc != 0) return rc; } while(0)
+
+// RelocMap::RunLength finds the skip and patch runs of the 3dsx relocation tables a word at a time,
+// it is checked against testing one bit at a time like 3dsxtool used to
+
+static size_t BitRunLength(const RelocMap& map, size_t i, size_t end, bool set)
+{
+	size_t start = i;
+	while (i < end && map.Test(i) == set)
+		i++;
+	return i - start;
+}
+
+// fill the map with runs up to max_run bits long
+static void FillMap(RelocMap& map, size_t size, size_t max_run)
+{
+	bool set = Random() & 1;
+
+	map.Assign(size);
+	for (size_t i = 0; i < size; set = !set)
+	{
+		size_t run = 1 + (Random() % max_run);
+		for (size_t j = 0; j < run && i < size; j++, i++)
+		{
+			if (set)
+				map.Set(i);
+		}
+	}
+}
+
+static int CompareRuns(const RelocMap& map, size_t pos, size_t end)
+{
+	// the walk of ElfConvert::BuildRelocs, a skip run then a patch run
+	for (size_t i = pos; i < end; )
+	{
+		for (int set = 0; set < 2; set++)
+		{
+			size_t run = map.RunLength(i, end, set);
+			size_t reference = BitRunLength(map, i, end, set);
+			if (run != reference)
+			{
+				fprintf(stderr, "[ERROR] %s run at bit 0x%x of a 0x%x bit map is 0x%x bits, not 0x%x.\n\n", set ? "Patch" : "Skip", (u32)i, (u32)map.size(), (u32)run, (u32)reference);
+				return 1;
+			}
+			i += run;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	SeedRandom(0x9E3779B9);
+
+	// short runs, runs around the word size and runs over the 0xFFFF of one relocation entry
+	static const size_t kMaxRun[] = { 1, 3, 17, 63, 64, 65, 200, 0x1FFFF, 0x30000 };
+	static const size_t kSize[] = { 1, 63, 64, 65, 1000, 0x10000, 0x4FFF3 };
+
+	for (size_t i = 0; i < sizeof(kMaxRun) / sizeof(kMaxRun[0]); i++)
+	{
+		for (size_t j = 0; j < sizeof(kSize) / sizeof(kSize[0]); j++)
+		{
+			RelocMap map;
+			FillMap(map, kSize[j], kMaxRun[i]);
+
+			// the whole map, and the segments of an image
+			safe_call(CompareRuns(map, 0, map.size()));
+			for (int k = 0; k < 8; k++)
+			{
+				size_t pos = Random() % map.size();
+				size_t end = pos + Random() % (map.size() - pos + 1);
+				safe_call(CompareRuns(map, pos, end));
+			}
+		}
+	}
+
+	// all clear and all set, so every run spans the whole map
+	RelocMap map;
+	map.Assign(0x30041);
+	safe_call(CompareRuns(map, 0, map.size()));
+	for (size_t i = 0; i < map.size(); i++)
+	{
+		map.Set(i);
+	}
+	safe_call(CompareRuns(map, 0, map.size()));
+	safe_call(CompareRuns(map, 5, map.size() - 7));
+
+	printf("Relocation runs: ok\n");
+
+	return 0;
+}
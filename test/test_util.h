@@ -0,0 +1,18 @@
+#pragma once
+#include "types.h"
+
+// xorshift32, seeded by each test so every run tests the same data
+static u32 rng_state = 0x12345678;
+
+static inline void SeedRandom(u32 seed)
+{
+	rng_state = seed;
+}
+
+static inline u32 Random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}